@@ -0,0 +1,272 @@
+/* HCI-IP mock VHCI controller
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_bt.h"
+
+#define LATENCY_US          CONFIG_VHCI_MOCK_LATENCY_US
+#define CREDITS             CONFIG_VHCI_MOCK_ACL_CREDITS
+#define ADV_INTERVAL_US     (CONFIG_VHCI_MOCK_ADV_INTERVAL_MS * 1000LL)
+#define ADV_DEVICES         CONFIG_VHCI_MOCK_ADV_DEVICES
+
+#define MOCK_MAX_PKT        (1 + 4 + 1021)
+#define MOCK_ACL_MTU        1021
+
+#define H4_COMMAND          0x01
+#define H4_ACL              0x02
+#define H4_EVENT            0x04
+
+#define OP_READ_BUFFER_SIZE     0x1005
+#define OP_READ_BD_ADDR         0x1009
+#define OP_LE_READ_BUFFER_SIZE  0x2002
+#define OP_LE_SET_SCAN_ENABLE   0x200c
+#define OP_LE_SET_EXT_SCAN_EN   0x2042
+
+typedef struct {
+    int64_t due_us;
+    uint16_t len;
+    uint8_t data[MOCK_MAX_PKT];
+} mock_pkt_t;
+
+static const char *TAG = "VHCI_MOCK";
+
+static esp_vhci_host_callback_t s_cb;
+static QueueHandle_t s_queue;
+static atomic_int s_credits = CREDITS;
+static volatile bool s_scanning;
+
+esp_err_t esp_bt_controller_mem_release(esp_bt_mode_t mode)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_controller_init(esp_bt_controller_config_t *cfg)
+{
+    s_queue = xQueueCreate(CREDITS, sizeof(mock_pkt_t));
+    return s_queue ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_vhci_host_register_callback(const esp_vhci_host_callback_t *callback)
+{
+    s_cb = *callback;
+    return ESP_OK;
+}
+
+bool esp_vhci_host_check_send_available(void)
+{
+    return atomic_load(&s_credits) > 0;
+}
+
+void esp_vhci_host_send_packet(uint8_t *data, uint16_t len)
+{
+    static mock_pkt_t pkt;
+
+    // the real controller asserts here, make the mistake visible instead
+    if (len > MOCK_MAX_PKT || atomic_fetch_sub(&s_credits, 1) <= 0) {
+        atomic_fetch_add(&s_credits, 1);
+        ESP_LOGE(TAG, "Packet sent without a free controller buffer, len %d", len);
+        return;
+    }
+
+    // callers serialize sends, like with the real VHCI
+    pkt.due_us = esp_timer_get_time() + LATENCY_US;
+    pkt.len = len;
+    memcpy(pkt.data, data, len);
+    xQueueSend(s_queue, &pkt, 0);
+}
+
+static void to_host(uint8_t *data, uint16_t len)
+{
+    if (s_cb.notify_host_recv)
+        s_cb.notify_host_recv(data, len);
+}
+
+static void return_credit(void)
+{
+    atomic_fetch_add(&s_credits, 1);
+    if (s_cb.notify_host_send_available)
+        s_cb.notify_host_send_available();
+}
+
+static void command_complete(uint16_t opcode, const uint8_t *ret, uint8_t ret_len)
+{
+    uint8_t evt[3 + 3 + 1 + 16] = { H4_EVENT, 0x0e, 4 + ret_len, 0x01, opcode & 0xff, opcode >> 8, 0x00 };
+
+    if (ret_len)
+        memcpy(&evt[7], ret, ret_len);
+    to_host(evt, 7 + ret_len);
+}
+
+static void handle_command(const mock_pkt_t *pkt)
+{
+    if (pkt->len < 4)
+        return;
+
+    uint16_t opcode = pkt->data[1] | (pkt->data[2] << 8);
+    const uint8_t *param = &pkt->data[4];
+
+    switch (opcode)
+    {
+      case OP_READ_BUFFER_SIZE: {
+        const uint8_t ret[] = { MOCK_ACL_MTU & 0xff, MOCK_ACL_MTU >> 8, 255, CREDITS, 0, 0, 0 };
+        command_complete(opcode, ret, sizeof(ret));
+        break;
+      }
+      case OP_LE_READ_BUFFER_SIZE: {
+        const uint8_t ret[] = { MOCK_ACL_MTU & 0xff, MOCK_ACL_MTU >> 8, CREDITS };
+        command_complete(opcode, ret, sizeof(ret));
+        break;
+      }
+      case OP_READ_BD_ADDR: {
+        const uint8_t ret[] = { 0x01, 0x00, 0x00, 0xc0, 0xde, 0xc0 };
+        command_complete(opcode, ret, sizeof(ret));
+        break;
+      }
+      case OP_LE_SET_SCAN_ENABLE:
+      case OP_LE_SET_EXT_SCAN_EN:
+        s_scanning = pkt->len > 4 && param[0];
+        command_complete(opcode, NULL, 0);
+        break;
+      default:
+        command_complete(opcode, NULL, 0);
+        break;
+    }
+}
+
+static void handle_acl(mock_pkt_t *pkt)
+{
+    if (pkt->len < 5)
+        return;
+
+    uint16_t handle = (pkt->data[1] | (pkt->data[2] << 8)) & 0x0fff;
+
+#ifdef CONFIG_VHCI_MOCK_ACL_LOOPBACK
+    to_host(pkt->data, pkt->len);
+#endif
+
+    uint8_t nocp[] = { H4_EVENT, 0x13, 5, 1, handle & 0xff, handle >> 8, 1, 0 };
+    to_host(nocp, sizeof(nocp));
+}
+
+static void send_adv_report(uint32_t n)
+{
+    char name[9];
+    uint32_t dev = n % ADV_DEVICES;
+    int name_len = snprintf(name, sizeof(name), "mock%04x", (unsigned)dev);
+
+    // [0x04][0x3e][plen][0x02][num][evt type][addr type][addr][dlen][data][rssi]
+    uint8_t evt[3 + 11 + 3 + 2 + 8 + 1];
+    int pos = 0;
+    evt[pos++] = H4_EVENT;
+    evt[pos++] = 0x3e;
+    pos++;
+    evt[pos++] = 0x02;
+    evt[pos++] = 1;
+    evt[pos++] = 0x00;
+    evt[pos++] = 0x00;
+    evt[pos++] = dev & 0xff;
+    evt[pos++] = dev >> 8;
+    evt[pos++] = 0x00;
+    evt[pos++] = 0x00;
+    evt[pos++] = 0xc0;
+    evt[pos++] = 0xde;
+    evt[pos++] = 3 + 2 + name_len;
+    evt[pos++] = 2;
+    evt[pos++] = 0x01;
+    evt[pos++] = 0x06;
+    evt[pos++] = 1 + name_len;
+    evt[pos++] = 0x09;
+    memcpy(&evt[pos], name, name_len);
+    pos += name_len;
+    evt[pos++] = (uint8_t)(int8_t)(-40 - (int)(n % 40));
+    evt[2] = pos - 3;
+    to_host(evt, pos);
+}
+
+/*
+ * @brief: Return at due_us. Whole ticks are slept, the part below one tick
+ *         is spun, so latencies shorter than a tick are kept
+ */
+static void wait_until(int64_t due_us)
+{
+    int64_t early = due_us - esp_timer_get_time();
+    if (early <= 0)
+        return;
+
+    // vTaskDelay(n) ends on a tick boundary, never later than n whole ticks
+    TickType_t ticks = early / (portTICK_PERIOD_MS * 1000);
+    if (ticks > 0)
+        vTaskDelay(ticks);
+    while (esp_timer_get_time() < due_us)
+        ;
+}
+
+/*
+ * @brief: Answer queued host packets after the configured latency and
+ *         generate advertising reports while scanning
+ */
+static void mock_controller_task(void *pvParameters)
+{
+    static mock_pkt_t pkt;
+    int64_t next_adv = esp_timer_get_time();
+    uint32_t adv_count = 0;
+
+    while (1) {
+        TickType_t wait = portMAX_DELAY;
+        if (s_scanning && ADV_INTERVAL_US) {
+            int64_t left = next_adv - esp_timer_get_time();
+            wait = left > 0 ? MAX(1, pdMS_TO_TICKS(left / 1000)) : 0;
+        }
+
+        if (xQueueReceive(s_queue, &pkt, wait) == pdTRUE) {
+            wait_until(pkt.due_us);
+
+            switch (pkt.data[0])
+            {
+              case H4_COMMAND:
+                handle_command(&pkt);
+                break;
+              case H4_ACL:
+                handle_acl(&pkt);
+                break;
+              default:
+                break;
+            }
+            return_credit();
+        }
+
+        int64_t now = esp_timer_get_time();
+        if (!s_scanning || !ADV_INTERVAL_US) {
+            next_adv = now;
+            continue;
+        }
+        // do not catch up with a long backlog of missed reports
+        if (now - next_adv > 10 * ADV_INTERVAL_US)
+            next_adv = now;
+        while (next_adv <= now) {
+            send_adv_report(adv_count++);
+            next_adv += ADV_INTERVAL_US;
+        }
+    }
+}
+
+esp_err_t esp_bt_controller_enable(esp_bt_mode_t mode)
+{
+    if (xTaskCreate(&mock_controller_task, "mock_controller", 4096, NULL, 7, NULL) != pdPASS)
+        return ESP_ERR_NO_MEM;
+    ESP_LOGI(TAG, "Mock controller: latency %d us, %d credits", LATENCY_US, CREDITS);
+    return ESP_OK;
+}
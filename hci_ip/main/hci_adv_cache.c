@@ -0,0 +1,137 @@
+/* HCI-IP LE advertising report de-duplication
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+#include <stdlib.h>
+#include "esp_log.h"
+#include "hci_proto.h"
+#include "hci_adv_cache.h"
+
+#define CACHE_WAYS          4
+#define CACHE_SETS          (CONFIG_HCI_IP_ADV_CACHE_SIZE / CACHE_WAYS)
+#define WINDOW_MS           CONFIG_HCI_IP_ADV_CACHE_WINDOW_MS
+#define RSSI_DELTA          CONFIG_HCI_IP_ADV_CACHE_RSSI_DELTA
+
+/* HCI_LE_Meta_Event, LE Advertising Report subevent */
+#define EVT_LE_META         0x3e
+#define SUBEVT_ADV_REPORT   0x02
+
+/*
+ * [0x04][0x3e][plen][0x02][num=1][evt_type][addr_type][addr 6][dlen][data][rssi]
+ */
+#define ADV_OFF_NUM         4
+#define ADV_OFF_EVT_TYPE    5
+#define ADV_OFF_ADDR_TYPE   6
+#define ADV_OFF_ADDR        7
+#define ADV_OFF_DATA_LEN    13
+#define ADV_OFF_DATA        14
+
+typedef struct {
+    uint8_t addr[6];
+    uint8_t addr_type;
+    uint8_t evt_type;
+    uint32_t hash;
+    uint32_t sent_ms;       /* 0 marks a free entry */
+    int8_t rssi;
+} adv_entry_t;
+
+static const char *TAG = "HCI_ADV_CACHE";
+
+static adv_entry_t *s_entries;
+static hci_adv_cache_stats_t s_stats;
+
+/* FNV-1a, cheap and good enough to tell payloads apart */
+static uint32_t fnv1a(uint32_t h, const uint8_t *data, int len)
+{
+    for (int i = 0; i < len; i++) {
+        h ^= data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+esp_err_t hci_adv_cache_init(void)
+{
+    s_entries = calloc(CACHE_SETS * CACHE_WAYS, sizeof(adv_entry_t));
+    if (!s_entries) {
+        ESP_LOGE(TAG, "Unable to allocate %d cache entries", CACHE_SETS * CACHE_WAYS);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+bool hci_adv_cache_suppress(const uint8_t *pkt, uint16_t len, int64_t now_us)
+{
+    // only plain single-report events are cached, everything else passes untouched
+    if (len < ADV_OFF_DATA + 1 || pkt[0] != H4_TYPE_EVENT || pkt[1] != EVT_LE_META ||
+        pkt[3] != SUBEVT_ADV_REPORT || pkt[ADV_OFF_NUM] != 1)
+        return false;
+
+    uint8_t data_len = pkt[ADV_OFF_DATA_LEN];
+    if (ADV_OFF_DATA + data_len + 1 != len)
+        return false;
+
+    const uint8_t *addr = &pkt[ADV_OFF_ADDR];
+    uint8_t addr_type = pkt[ADV_OFF_ADDR_TYPE];
+    uint8_t evt_type = pkt[ADV_OFF_EVT_TYPE];
+    int8_t rssi = (int8_t)pkt[len - 1];
+    uint32_t hash = fnv1a(2166136261u, &pkt[ADV_OFF_DATA], data_len);
+    // 0 is reserved for free entries
+    uint32_t now_ms = (uint32_t)(now_us / 1000) | 1;
+
+    s_stats.reports++;
+
+    // keyed on the PDU type too, an active scan alternates ADV_IND and SCAN_RSP
+    // from every device and each of them is repeated on its own
+    uint32_t set = fnv1a(fnv1a(2166136261u, addr, 6), &evt_type, 1) % CACHE_SETS;
+    adv_entry_t *ways = &s_entries[set * CACHE_WAYS];
+    adv_entry_t *entry = NULL;
+    adv_entry_t *victim = &ways[0];
+
+    for (int i = 0; i < CACHE_WAYS; i++) {
+        if (ways[i].sent_ms && ways[i].evt_type == evt_type && ways[i].addr_type == addr_type &&
+            !memcmp(ways[i].addr, addr, 6)) {
+            entry = &ways[i];
+            break;
+        }
+        // prefer a free entry, otherwise the least recently forwarded one
+        if (victim->sent_ms && (!ways[i].sent_ms || now_ms - ways[i].sent_ms > now_ms - victim->sent_ms))
+            victim = &ways[i];
+    }
+
+    if (entry) {
+        if (entry->hash != hash) {
+            s_stats.changed++;
+        } else if (abs(rssi - entry->rssi) >= RSSI_DELTA) {
+            s_stats.rssi_passes++;
+        } else if (now_ms - entry->sent_ms >= WINDOW_MS) {
+            s_stats.expired++;
+        } else {
+            s_stats.hits++;
+            return true;
+        }
+    } else {
+        s_stats.misses++;
+        if (victim->sent_ms)
+            s_stats.evictions++;
+        entry = victim;
+        memcpy(entry->addr, addr, 6);
+        entry->addr_type = addr_type;
+        entry->evt_type = evt_type;
+    }
+
+    entry->hash = hash;
+    entry->rssi = rssi;
+    entry->sent_ms = now_ms;
+    return false;
+}
+
+void hci_adv_cache_get_stats(hci_adv_cache_stats_t *stats)
+{
+    *stats = s_stats;
+}
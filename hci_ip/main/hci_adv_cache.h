@@ -0,0 +1,57 @@
+/* HCI-IP LE advertising report de-duplication
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Small set-associative cache keyed on advertiser address and advertising
+ * type, so the advertising data and the scan response of a device each
+ * have an entry. An LE Advertising Report is suppressed when the same
+ * address and type sent the same payload within
+ * CONFIG_HCI_IP_ADV_CACHE_WINDOW_MS and the RSSI moved less than
+ * CONFIG_HCI_IP_ADV_CACHE_RSSI_DELTA. Only used by the upstream task.
+ */
+
+typedef struct {
+    uint32_t reports;       /* single-report advertising events looked up */
+    uint32_t hits;          /* reports suppressed */
+    uint32_t misses;        /* address and event type not in the cache */
+    uint32_t changed;       /* payload changed */
+    uint32_t rssi_passes;   /* same payload forwarded because RSSI moved */
+    uint32_t expired;       /* same payload forwarded because the window elapsed */
+    uint32_t evictions;     /* entries replaced to make room */
+} hci_adv_cache_stats_t;
+
+/*
+ * @brief: Allocate the cache entries
+ */
+esp_err_t hci_adv_cache_init(void);
+
+/*
+ * @brief: Check one controller to host H4 packet
+ * return: true if it is a duplicate advertising report that should not be sent
+ */
+bool hci_adv_cache_suppress(const uint8_t *pkt, uint16_t len, int64_t now_us);
+
+/*
+ * @brief: Snapshot of the cache counters
+ */
+void hci_adv_cache_get_stats(hci_adv_cache_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
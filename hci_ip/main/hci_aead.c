@@ -0,0 +1,466 @@
+/* HCI-IP link encryption
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "nvs.h"
+#include "mbedtls/md.h"
+#ifdef CONFIG_HCI_IP_AEAD_CCM
+#include "mbedtls/ccm.h"
+#else
+#include "mbedtls/gcm.h"
+#endif
+#include "hci_proto.h"
+#include "hci_aead.h"
+
+#define IV_LEN              12
+#define DIR_HOST            0
+#define DIR_TARGET          1
+#define KDF_LABEL           "HCI-IP AEAD"
+#define KDF_LABEL_LEN       (sizeof(KDF_LABEL) - 1)
+#define INIT_LABEL          "HCI-IP AUTH"
+#define INIT_LABEL_LEN      (sizeof(INIT_LABEL) - 1)
+/* largest datagram the target sends, a reliable frame holding a full bundle
+ * or a single packet, see TX_PAYLOAD_SIZE in hci_rel.c */
+#define TX_MAX              (MAX(CONFIG_HCI_IP_BUNDLE_MTU, 1 + HCI_IP_BUNDLE_REC_HDR + HCI_IP_MAX_PKT_SIZE) + HCI_IP_REL_DATA_HDR)
+#define SELF_TEST_ROUNDS    32
+
+#ifdef CONFIG_HCI_IP_AEAD_CCM
+#define CIPHER_NAME         "AES-CCM"
+typedef mbedtls_ccm_context aead_ctx_t;
+#else
+#define CIPHER_NAME         "AES-GCM"
+typedef mbedtls_gcm_context aead_ctx_t;
+#endif
+
+static const char *TAG = "HCI_AEAD";
+
+static uint8_t s_psk[32];
+static uint8_t s_psk_len;           // 0 when no key is provisioned
+
+// the cipher contexts are shared by all senders and the receive task
+static SemaphoreHandle_t s_lock;
+static aead_ctx_t s_ctx[2];
+static aead_ctx_t *s_live = &s_ctx[0];  // session key in use
+static aead_ctx_t *s_next = &s_ctx[1];  // key from the last AUTH_RSP
+static bool s_keyed;                // s_live holds a session key
+static bool s_pending;              // s_next holds a key the host has not used yet
+static uint64_t s_tx_seq;
+static uint8_t *s_tx;               // sealed datagram being sent
+static uint8_t *s_rx_copy;          // ciphertext kept while both keys are tried
+static uint64_t s_rx_max;           // newest seq accepted from the host
+static uint64_t s_rx_window;        // bit i: seq s_rx_max - i was accepted
+static hci_aead_stats_t s_stats;
+
+static void put_le64(uint8_t *p, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+        p[i] = v >> (8 * i);
+}
+
+static uint64_t get_le64(const uint8_t *p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--)
+        v = v << 8 | p[i];
+    return v;
+}
+
+static int set_key(aead_ctx_t *ctx, const uint8_t *key)
+{
+#ifdef CONFIG_HCI_IP_AEAD_CCM
+    return mbedtls_ccm_setkey(ctx, MBEDTLS_CIPHER_ID_AES, key, s_psk_len * 8);
+#else
+    return mbedtls_gcm_setkey(ctx, MBEDTLS_CIPHER_ID_AES, key, s_psk_len * 8);
+#endif
+}
+
+/* encrypts buf in place */
+static int seal(aead_ctx_t *ctx, uint8_t dir, uint64_t seq, const uint8_t *aad, size_t aad_len, uint8_t *buf,
+                size_t len, uint8_t *tag)
+{
+    uint8_t iv[IV_LEN] = { dir };
+
+    put_le64(&iv[4], seq);
+#ifdef CONFIG_HCI_IP_AEAD_CCM
+    return mbedtls_ccm_encrypt_and_tag(ctx, len, iv, IV_LEN, aad, aad_len, buf, buf, tag, HCI_IP_AEAD_TAG_LEN);
+#else
+    return mbedtls_gcm_crypt_and_tag(ctx, MBEDTLS_GCM_ENCRYPT, len, iv, IV_LEN, aad, aad_len, buf, buf,
+                                     HCI_IP_AEAD_TAG_LEN, tag);
+#endif
+}
+
+/* decrypts buf in place, non-zero if the tag does not match, buf is then garbage */
+static int unseal(aead_ctx_t *ctx, uint8_t dir, uint64_t seq, const uint8_t *aad, size_t aad_len, uint8_t *buf,
+                  size_t len, const uint8_t *tag)
+{
+    uint8_t iv[IV_LEN] = { dir };
+
+    put_le64(&iv[4], seq);
+#ifdef CONFIG_HCI_IP_AEAD_CCM
+    return mbedtls_ccm_auth_decrypt(ctx, len, iv, IV_LEN, aad, aad_len, buf, buf, tag, HCI_IP_AEAD_TAG_LEN);
+#else
+    return mbedtls_gcm_auth_decrypt(ctx, len, iv, IV_LEN, aad, aad_len, tag, HCI_IP_AEAD_TAG_LEN, buf, buf);
+#endif
+}
+
+static int hmac(const uint8_t *msg, size_t len, uint8_t *out)
+{
+    return mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), s_psk, s_psk_len, msg, len, out);
+}
+
+static bool replay_ok(uint64_t seq)
+{
+    // 0 only tags the handshake answer
+    if (seq == 0)
+        return false;
+    if (seq > s_rx_max)
+        return true;
+    uint64_t age = s_rx_max - seq;
+    return age < HCI_IP_AEAD_REPLAY_WINDOW && !(s_rx_window & (1ull << age));
+}
+
+static void replay_mark(uint64_t seq)
+{
+    if (seq > s_rx_max) {
+        uint64_t shift = seq - s_rx_max;
+        s_rx_window = shift < HCI_IP_AEAD_REPLAY_WINDOW ? s_rx_window << shift : 0;
+        s_rx_window |= 1;
+        s_rx_max = seq;
+    } else {
+        s_rx_window |= 1ull << (s_rx_max - seq);
+    }
+}
+
+/*
+ * @brief: Seal and open test datagrams with a throwaway key. Also logs the
+ *         cost per datagram, to compare hardware and software AES
+ */
+static esp_err_t self_test(void)
+{
+    static const uint16_t sizes[] = { 16, 64, 256, 1024 };
+    static const uint8_t aad[HCI_IP_AEAD_HDR] = { HCI_IP_PKT_SEALED };
+    uint8_t key[32];
+    uint8_t tag[HCI_IP_AEAD_TAG_LEN];
+
+    esp_fill_random(key, sizeof(key));
+    if (set_key(s_live, key) != 0)
+        return ESP_FAIL;
+
+    for (int i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+        uint16_t len = sizes[i];
+        int64_t seal_us = 0;
+        int64_t open_us = 0;
+
+        for (int r = 0; r < SELF_TEST_ROUNDS; r++) {
+            for (int j = 0; j < len; j++)
+                s_tx[j] = j + r;
+            int64_t t0 = esp_timer_get_time();
+            int err = seal(s_live, DIR_TARGET, r + 1, aad, sizeof(aad), s_tx, len, tag);
+            int64_t t1 = esp_timer_get_time();
+            err |= unseal(s_live, DIR_TARGET, r + 1, aad, sizeof(aad), s_tx, len, tag);
+            int64_t t2 = esp_timer_get_time();
+            for (int j = 0; j < len && !err; j++)
+                err = s_tx[j] != (uint8_t)(j + r);
+            if (err) {
+                ESP_LOGE(TAG, "%s round trip failed", CIPHER_NAME);
+                return ESP_FAIL;
+            }
+            seal_us += t1 - t0;
+            open_us += t2 - t1;
+        }
+        ESP_LOGI(TAG, "%s-%d, %u byte datagram: seal %lu ns, open %lu ns", CIPHER_NAME, s_psk_len * 8, len,
+                 (unsigned long)(seal_us * 1000 / SELF_TEST_ROUNDS), (unsigned long)(open_us * 1000 / SELF_TEST_ROUNDS));
+    }
+
+    // a modified datagram must be rejected
+    seal(s_live, DIR_TARGET, 1, aad, sizeof(aad), s_tx, 16, tag);
+    s_tx[0] ^= 1;
+    if (unseal(s_live, DIR_TARGET, 1, aad, sizeof(aad), s_tx, 16, tag) == 0) {
+        ESP_LOGE(TAG, "%s accepted a modified datagram", CIPHER_NAME);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t hci_aead_init(void)
+{
+    nvs_handle_t nvs;
+    size_t len = sizeof(s_psk);
+
+    if (nvs_open(HCI_AEAD_NVS_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK) {
+        if (nvs_get_blob(nvs, HCI_AEAD_NVS_KEY, s_psk, &len) == ESP_OK && (len == 16 || len == 32))
+            s_psk_len = len;
+        nvs_close(nvs);
+    }
+    if (!s_psk_len) {
+        ESP_LOGW(TAG, "No link key provisioned, HCI traffic is not encrypted");
+        return ESP_OK;
+    }
+
+    s_lock = xSemaphoreCreateMutex();
+    s_tx = malloc(HCI_IP_AEAD_OVERHEAD + TX_MAX);
+    s_rx_copy = malloc(HCI_IP_MAX_DGRAM_SIZE);
+    if (!s_lock || !s_tx || !s_rx_copy) {
+        ESP_LOGE(TAG, "Unable to allocate the sealing buffers");
+        return ESP_ERR_NO_MEM;
+    }
+    for (int i = 0; i < 2; i++) {
+#ifdef CONFIG_HCI_IP_AEAD_CCM
+        mbedtls_ccm_init(&s_ctx[i]);
+#else
+        mbedtls_gcm_init(&s_ctx[i]);
+#endif
+    }
+
+    // refuse to run with a cipher that does not work
+    esp_err_t err = self_test();
+    if (err != ESP_OK)
+        return err;
+    ESP_LOGI(TAG, "Link key provisioned, every datagram is sealed with %s-%d", CIPHER_NAME, s_psk_len * 8);
+    return ESP_OK;
+}
+
+bool hci_aead_enabled(void)
+{
+    return s_psk_len != 0;
+}
+
+int hci_aead_auth(const uint8_t *pkt, int len, uint8_t *rsp, int rsp_size)
+{
+    if (len != HCI_IP_AUTH_INIT_LEN || pkt[1] != HCI_IP_AUTH_INIT || rsp_size < HCI_IP_AUTH_RSP_LEN) {
+        s_stats.auth_failed++;
+        ESP_LOGW(TAG, "Malformed AUTH, len %d", len);
+        return 0;
+    }
+
+    // only a host holding the PSK gets an answer
+    uint8_t init[INIT_LABEL_LEN + HCI_IP_AUTH_NONCE_LEN];
+    uint8_t mac[32];
+    memcpy(init, INIT_LABEL, INIT_LABEL_LEN);
+    memcpy(&init[INIT_LABEL_LEN], &pkt[2], HCI_IP_AUTH_NONCE_LEN);
+    if (hmac(init, sizeof(init), mac) != 0)
+        return 0;
+    uint8_t diff = 0;
+    for (int i = 0; i < HCI_IP_AEAD_TAG_LEN; i++)
+        diff |= mac[i] ^ pkt[2 + HCI_IP_AUTH_NONCE_LEN + i];
+    if (diff) {
+        s_stats.auth_failed++;
+        ESP_LOGW(TAG, "AUTH_INIT with a bad tag");
+        return 0;
+    }
+
+    // session key from the PSK and a fresh nonce from each side, so no
+    // nonce is ever reused under the same key, not even across reboots
+    uint8_t kdf[KDF_LABEL_LEN + 2 * HCI_IP_AUTH_NONCE_LEN];
+    uint8_t *nh = &kdf[KDF_LABEL_LEN];
+    uint8_t *nt = &kdf[KDF_LABEL_LEN + HCI_IP_AUTH_NONCE_LEN];
+    uint8_t key[32];
+    memcpy(kdf, KDF_LABEL, KDF_LABEL_LEN);
+    memcpy(nh, &pkt[2], HCI_IP_AUTH_NONCE_LEN);
+    esp_fill_random(nt, HCI_IP_AUTH_NONCE_LEN);
+    if (hmac(kdf, sizeof(kdf), key) != 0)
+        return 0;
+
+    uint8_t aad[2 + 2 * HCI_IP_AUTH_NONCE_LEN] = { HCI_IP_PKT_AUTH, HCI_IP_AUTH_RSP };
+    memcpy(&aad[2], nh, 2 * HCI_IP_AUTH_NONCE_LEN);
+    rsp[0] = HCI_IP_PKT_AUTH;
+    rsp[1] = HCI_IP_AUTH_RSP;
+    memcpy(&rsp[2], nt, HCI_IP_AUTH_NONCE_LEN);
+
+    // the running session keeps its key until the host seals with the new one,
+    // a replayed AUTH_INIT can only replace a key that nobody used
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    int err = set_key(s_next, key);
+    if (err == 0)
+        err = seal(s_next, DIR_TARGET, 0, aad, sizeof(aad), rsp, 0, &rsp[2 + HCI_IP_AUTH_NONCE_LEN]);
+    s_pending = err == 0;
+    xSemaphoreGive(s_lock);
+    memset(key, 0, sizeof(key));
+
+    if (err) {
+        ESP_LOGE(TAG, "Unable to set the session key: %d", err);
+        return 0;
+    }
+    return HCI_IP_AUTH_RSP_LEN;
+}
+
+int hci_aead_open(uint8_t *pkt, int len, uint8_t **plain)
+{
+    if (len < HCI_IP_AEAD_OVERHEAD + 1 || pkt[0] != HCI_IP_PKT_SEALED) {
+        s_stats.auth_failed++;
+        ESP_LOGD(TAG, "Dropping unsealed datagram, type 0x%02x", pkt[0]);
+        return 0;
+    }
+
+    uint64_t seq = get_le64(&pkt[1]);
+    int plain_len = len - HCI_IP_AEAD_OVERHEAD;
+    uint8_t *body = &pkt[HCI_IP_AEAD_HDR];
+    int err = -1;
+    bool replayed = false;
+    bool new_key = false;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (!s_keyed && !s_pending) {
+        xSemaphoreGive(s_lock);
+        s_stats.no_session++;
+        return 0;
+    }
+    int64_t start = esp_timer_get_time();
+    if (s_keyed && replay_ok(seq)) {
+        // a failed open clears the buffer, keep the ciphertext for the new key
+        if (s_pending)
+            memcpy(s_rx_copy, body, plain_len + HCI_IP_AEAD_TAG_LEN);
+        err = unseal(s_live, DIR_HOST, seq, pkt, HCI_IP_AEAD_HDR, body, plain_len, &body[plain_len]);
+        // only an authentic datagram moves the window
+        if (err == 0)
+            replay_mark(seq);
+        else if (s_pending)
+            memcpy(body, s_rx_copy, plain_len + HCI_IP_AEAD_TAG_LEN);
+    } else {
+        replayed = s_keyed;
+    }
+    if (err && s_pending && seq != 0) {
+        // the first datagram sealed with the new key proves the host derived it
+        err = unseal(s_next, DIR_HOST, seq, pkt, HCI_IP_AEAD_HDR, body, plain_len, &body[plain_len]);
+        if (err == 0) {
+            aead_ctx_t *old = s_live;
+            s_live = s_next;
+            s_next = old;
+            s_keyed = true;
+            s_pending = false;
+            s_tx_seq = 0;
+            s_rx_max = 0;
+            s_rx_window = 0;
+            replay_mark(seq);
+            new_key = true;
+        }
+    }
+    s_stats.open_us += esp_timer_get_time() - start;
+    xSemaphoreGive(s_lock);
+
+    if (err) {
+        if (replayed)
+            s_stats.replayed++;
+        else
+            s_stats.auth_failed++;
+        return 0;
+    }
+    if (new_key) {
+        s_stats.handshakes++;
+        ESP_LOGI(TAG, "New session key");
+    }
+    s_stats.opened++;
+    *plain = body;
+    return plain_len;
+}
+
+int hci_aead_sendv(const struct iovec *iov, int iovcnt, int (*send)(const struct iovec *iov, int iovcnt))
+{
+    int len = 0;
+    for (int i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+    if (len > TX_MAX) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (!s_keyed) {
+        xSemaphoreGive(s_lock);
+        errno = ENOTCONN;
+        return -1;
+    }
+
+    uint8_t *body = &s_tx[HCI_IP_AEAD_HDR];
+    int pos = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(&body[pos], iov[i].iov_base, iov[i].iov_len);
+        pos += iov[i].iov_len;
+    }
+    uint64_t seq = ++s_tx_seq;
+    s_tx[0] = HCI_IP_PKT_SEALED;
+    put_le64(&s_tx[1], seq);
+
+    int64_t start = esp_timer_get_time();
+    int ret = seal(s_live, DIR_TARGET, seq, s_tx, HCI_IP_AEAD_HDR, body, len, &body[len]);
+    s_stats.seal_us += esp_timer_get_time() - start;
+    if (ret == 0) {
+        // sent under the lock, so datagrams leave in seq order
+        struct iovec out = { .iov_base = s_tx, .iov_len = HCI_IP_AEAD_OVERHEAD + len };
+        ret = send(&out, 1);
+        s_stats.sealed++;
+    } else {
+        errno = EIO;
+        ret = -1;
+    }
+    xSemaphoreGive(s_lock);
+    return ret < 0 ? ret : len;
+}
+
+void hci_aead_reset(void)
+{
+    if (!s_psk_len)
+        return;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_keyed = false;
+    s_pending = false;
+    xSemaphoreGive(s_lock);
+}
+
+esp_err_t hci_aead_provision(const char *hex)
+{
+    uint8_t key[sizeof(s_psk)];
+    size_t len = strlen(hex) / 2;
+    bool erase = !strcmp(hex, "-");
+    nvs_handle_t nvs;
+    esp_err_t err;
+
+    if (!erase) {
+        if ((strlen(hex) != 32 && strlen(hex) != 64) || strspn(hex, "0123456789abcdefABCDEF") != strlen(hex)) {
+            ESP_LOGE(TAG, "Link key must be 32 or 64 hex digits");
+            return ESP_ERR_INVALID_ARG;
+        }
+        for (size_t i = 0; i < len; i++) {
+            unsigned int byte;
+            sscanf(&hex[2 * i], "%2x", &byte);
+            key[i] = byte;
+        }
+    }
+
+    err = nvs_open(HCI_AEAD_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK)
+        return err;
+    err = erase ? nvs_erase_key(nvs, HCI_AEAD_NVS_KEY) : nvs_set_blob(nvs, HCI_AEAD_NVS_KEY, key, len);
+    if (err == ESP_ERR_NVS_NOT_FOUND)
+        err = ESP_OK;
+    if (err == ESP_OK)
+        err = nvs_commit(nvs);
+    nvs_close(nvs);
+    memset(key, 0, sizeof(key));
+
+    if (err == ESP_OK && erase)
+        ESP_LOGI(TAG, "Link key erased, HCI traffic is not encrypted");
+    else if (err == ESP_OK)
+        ESP_LOGI(TAG, "Link key stored");
+    return err;
+}
+
+void hci_aead_get_stats(hci_aead_stats_t *stats)
+{
+    *stats = s_stats;
+}
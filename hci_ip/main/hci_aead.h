@@ -0,0 +1,96 @@
+/* HCI-IP link encryption
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "lwip/sockets.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Authenticated encryption of every datagram on CONFIG_HCI_IP_PORT, see
+ * HCI_IP_AEAD_* in hci_proto.h. Turned on by a pre-shared key in NVS,
+ * namespace HCI_AEAD_NVS_NAMESPACE, blob HCI_AEAD_NVS_KEY, 16 or 32 bytes
+ * for AES-128 or AES-256. Without a key the link stays in the clear.
+ */
+
+#define HCI_AEAD_NVS_NAMESPACE  "hci_ip"
+#define HCI_AEAD_NVS_KEY        "psk"
+
+typedef struct {
+    uint32_t handshakes;    /* session keys confirmed by the host */
+    uint32_t sealed;        /* datagrams encrypted */
+    uint32_t opened;        /* datagrams decrypted and authenticated */
+    uint32_t no_session;    /* dropped, the host has not done a handshake */
+    uint32_t auth_failed;   /* dropped, bad tag or framing */
+    uint32_t replayed;      /* dropped, seq seen before or too old */
+    uint32_t seal_us;       /* time spent encrypting */
+    uint32_t open_us;       /* time spent decrypting */
+} hci_aead_stats_t;
+
+/*
+ * @brief: Load the pre-shared key and check the cipher on a test message
+ * return: ESP_OK also when no key is provisioned
+ */
+esp_err_t hci_aead_init(void);
+
+/*
+ * @brief: True if a key is provisioned, every datagram must be sealed
+ */
+bool hci_aead_enabled(void);
+
+/*
+ * @brief: Handle one HCI_IP_PKT_AUTH datagram. A valid AUTH_INIT derives the
+ *         next session key, the current one stays in use until the host seals
+ *         a datagram with the next
+ * params: rsp: buffer for the reply of HCI_IP_AUTH_RSP_LEN bytes, to be sent
+ *         in the clear to the sender of pkt
+ * return: reply length, 0 if there is nothing to send back
+ */
+int hci_aead_auth(const uint8_t *pkt, int len, uint8_t *rsp, int rsp_size);
+
+/*
+ * @brief: Authenticate and decrypt one HCI_IP_PKT_SEALED datagram in place,
+ *         with the current or the next session key. The next key replaces the
+ *         current one once a datagram opens with it
+ * params: plain: set to the datagram inside pkt
+ * return: datagram length, 0 if it has to be dropped
+ */
+int hci_aead_open(uint8_t *pkt, int len, uint8_t **plain);
+
+/*
+ * @brief: Seal one datagram and hand it to send, serialized between senders
+ * return: datagram length, or -1 with errno set
+ */
+int hci_aead_sendv(const struct iovec *iov, int iovcnt, int (*send)(const struct iovec *iov, int iovcnt));
+
+/*
+ * @brief: Forget the session key, the host has to do a new handshake
+ */
+void hci_aead_reset(void);
+
+/*
+ * @brief: Store the link key given as 32 or 64 hex digits in NVS, "-" erases
+ *         it. Used after a restart
+ */
+esp_err_t hci_aead_provision(const char *hex);
+
+/*
+ * @brief: Snapshot of the encryption counters
+ */
+void hci_aead_get_stats(hci_aead_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,283 @@
+/* HCI-IP link benchmark
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "hci_proto.h"
+#include "hci_bench.h"
+#include "hci_ps.h"
+
+#define BENCH_HDR           2       /* [0x0a][op] */
+#define STREAM_HDR          (BENCH_HDR + 8)
+// largest UDP payload in one Ethernet frame, less the sealing overhead
+#ifdef CONFIG_HCI_IP_AEAD
+#define STREAM_MAX_SIZE     (1472 - HCI_IP_AEAD_OVERHEAD)
+#else
+#define STREAM_MAX_SIZE     1472
+#endif
+#define SEND_RETRIES        20
+
+typedef struct {
+    uint32_t pkts;
+    uint32_t bytes;
+    uint32_t lost;
+    uint32_t reordered;
+    uint32_t first_us;
+    uint32_t last_us;
+    uint32_t next_seq;
+} bench_sink_t;
+
+typedef struct {
+    uint32_t sent;
+    uint32_t errors;
+    uint32_t retries;
+    uint32_t first_us;
+    uint32_t last_us;
+} bench_stream_stats_t;
+
+static const char *TAG = "HCI_BENCH";
+
+static hci_bench_send_fn s_send;
+static TaskHandle_t s_task;
+
+// sink counters, receive task only
+static bench_sink_t s_sink;
+
+// stream request, written by the receive task and picked up by the stream task
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint16_t s_req_size;
+static uint32_t s_req_count;
+static uint32_t s_req_interval_us;
+static uint32_t s_req_gen;
+
+static bench_stream_stats_t s_stream;
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+/*
+ * @brief: Send one datagram, retry while lwIP is out of buffers
+ * return: 0 when sent, -1 when given up
+ */
+static int send_datagram(const uint8_t *data, uint16_t len, uint32_t *retries)
+{
+    for (int attempt = 0; attempt <= SEND_RETRIES; attempt++) {
+        int sent = s_send(data, len);
+        if (sent == len)
+            return 0;
+        // datagrams are never split, a short or failed write is retried whole
+        if (sent >= 0 || errno == ENOMEM || errno == EAGAIN || errno == ENOBUFS) {
+            if (retries)
+                (*retries)++;
+            vTaskDelay(1);
+            continue;
+        }
+        ESP_LOGW(TAG, "Error occurred during send: errno %d", errno);
+        return -1;
+    }
+    return -1;
+}
+
+static void handle_echo(uint8_t *data, int len)
+{
+    if (len < BENCH_HDR + 12)
+        return;
+
+    data[1] = HCI_IP_BENCH_ECHO | HCI_IP_BENCH_RSP;
+    put_le32(&data[BENCH_HDR + 8], (uint32_t)esp_timer_get_time());
+    send_datagram(data, len, NULL);
+}
+
+static void handle_sink(const uint8_t *data, int len)
+{
+    uint32_t now = (uint32_t)esp_timer_get_time();
+
+    if (len < BENCH_HDR + 4)
+        return;
+
+    uint32_t seq = get_le32(&data[BENCH_HDR]);
+    if (s_sink.pkts == 0)
+        s_sink.first_us = now;
+    s_sink.last_us = now;
+    s_sink.pkts++;
+    s_sink.bytes += len;
+
+    if (seq >= s_sink.next_seq) {
+        // every skipped sequence counts as lost until it shows up late
+        s_sink.lost += seq - s_sink.next_seq;
+        s_sink.next_seq = seq + 1;
+    } else {
+        s_sink.reordered++;
+        if (s_sink.lost)
+            s_sink.lost--;
+    }
+}
+
+static void send_report(void)
+{
+    uint8_t rsp[BENCH_HDR + 36];
+    bench_stream_stats_t stream;
+
+    portENTER_CRITICAL(&s_lock);
+    stream = s_stream;
+    portEXIT_CRITICAL(&s_lock);
+
+    rsp[0] = HCI_IP_PKT_TEST;
+    rsp[1] = HCI_IP_BENCH_REPORT | HCI_IP_BENCH_RSP;
+    put_le32(&rsp[2], s_sink.pkts);
+    put_le32(&rsp[6], s_sink.bytes);
+    put_le32(&rsp[10], s_sink.lost);
+    put_le32(&rsp[14], s_sink.reordered);
+    put_le32(&rsp[18], s_sink.last_us - s_sink.first_us);
+    put_le32(&rsp[22], stream.sent);
+    put_le32(&rsp[26], stream.errors);
+    put_le32(&rsp[30], stream.retries);
+    put_le32(&rsp[34], stream.last_us - stream.first_us);
+    send_datagram(rsp, sizeof(rsp), NULL);
+}
+
+static void handle_stream(const uint8_t *data, int len)
+{
+    if (len < BENCH_HDR + 10)
+        return;
+
+    uint16_t size = data[2] | (data[3] << 8);
+    uint32_t count = get_le32(&data[4]);
+    uint32_t interval_us = get_le32(&data[8]);
+
+    if (size < STREAM_HDR)
+        size = STREAM_HDR;
+    if (size > STREAM_MAX_SIZE)
+        size = STREAM_MAX_SIZE;
+
+    portENTER_CRITICAL(&s_lock);
+    s_req_size = size;
+    s_req_count = count;
+    s_req_interval_us = interval_us;
+    s_req_gen++;
+    portEXIT_CRITICAL(&s_lock);
+
+    ESP_LOGI(TAG, "Stream of %" PRIu32 " x %d bytes every %" PRIu32 " us", count, size, interval_us);
+    xTaskNotifyGive(s_task);
+}
+
+void hci_bench_handle(uint8_t *data, int len)
+{
+    uint8_t op = len >= BENCH_HDR ? data[1] : 0;
+
+    // benchmark runs wake the station and keep it awake like HCI traffic
+    hci_ps_touch();
+
+    switch (op)
+    {
+      case HCI_IP_BENCH_ECHO:
+        handle_echo(data, len);
+        break;
+      case HCI_IP_BENCH_STREAM:
+        handle_stream(data, len);
+        break;
+      case HCI_IP_BENCH_SINK:
+        handle_sink(data, len);
+        break;
+      case HCI_IP_BENCH_RESET:
+        memset(&s_sink, 0, sizeof(s_sink));
+        portENTER_CRITICAL(&s_lock);
+        memset(&s_stream, 0, sizeof(s_stream));
+        portEXIT_CRITICAL(&s_lock);
+        send_report();
+        break;
+      case HCI_IP_BENCH_REPORT:
+        send_report();
+        break;
+      default:
+        // legacy test echo, sent back unchanged
+        send_datagram(data, len, NULL);
+        break;
+    }
+}
+
+/*
+ * @brief: Generate the upstream stream, paced against esp_timer so intervals
+ *         below one tick are sent as small bursts
+ */
+static void bench_stream_task(void *pvParameters)
+{
+    static uint8_t buf[STREAM_MAX_SIZE];
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        portENTER_CRITICAL(&s_lock);
+        uint16_t size = s_req_size;
+        uint32_t count = s_req_count;
+        uint32_t interval_us = s_req_interval_us;
+        uint32_t gen = s_req_gen;
+        portEXIT_CRITICAL(&s_lock);
+
+        memset(buf, 0, size);
+        buf[0] = HCI_IP_PKT_TEST;
+        buf[1] = HCI_IP_BENCH_STREAM | HCI_IP_BENCH_RSP;
+
+        int64_t start = esp_timer_get_time();
+        for (uint32_t seq = 0; seq < count; seq++) {
+            // a new request, including count 0, replaces the running stream
+            if (gen != s_req_gen)
+                break;
+
+            if (interval_us) {
+                int64_t due = start + (int64_t)seq * interval_us;
+                int64_t now = esp_timer_get_time();
+                if (due - now >= 1000000 / configTICK_RATE_HZ)
+                    vTaskDelay((due - now) * configTICK_RATE_HZ / 1000000);
+            }
+
+            uint32_t now = (uint32_t)esp_timer_get_time();
+            put_le32(&buf[BENCH_HDR], seq);
+            put_le32(&buf[BENCH_HDR + 4], now);
+
+            uint32_t retries = 0;
+            hci_ps_touch();
+            int err = send_datagram(buf, size, &retries);
+
+            portENTER_CRITICAL(&s_lock);
+            if (s_stream.sent == 0 && s_stream.errors == 0)
+                s_stream.first_us = now;
+            s_stream.last_us = now;
+            s_stream.retries += retries;
+            if (err)
+                s_stream.errors++;
+            else
+                s_stream.sent++;
+            portEXIT_CRITICAL(&s_lock);
+        }
+        ESP_LOGI(TAG, "Stream done, %" PRIu32 " sent", s_stream.sent);
+    }
+}
+
+esp_err_t hci_bench_init(hci_bench_send_fn send)
+{
+    s_send = send;
+    if (xTaskCreatePinnedToCore(&bench_stream_task, "bench_stream_task", 3072, NULL, 4, &s_task, 0) != pdPASS)
+        return ESP_ERR_NO_MEM;
+    return ESP_OK;
+}
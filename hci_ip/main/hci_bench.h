@@ -0,0 +1,41 @@
+/* HCI-IP link benchmark
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Benchmark side of the HCI_IP_PKT_TEST packets, see HCI_IP_BENCH_* in
+ * hci_proto.h. Measures the raw Wi-Fi link: bench datagrams bypass the H2C
+ * queue, the C2H rings and the reliability layer. hci_ip_bench.py in
+ * hci_ip/scripts is the host side.
+ */
+
+typedef int (*hci_bench_send_fn)(const uint8_t *data, uint16_t len);
+
+/*
+ * @brief: Start the stream task
+ * params: send: writes one datagram to the current host
+ */
+esp_err_t hci_bench_init(hci_bench_send_fn send);
+
+/*
+ * @brief: Handle one HCI_IP_PKT_TEST datagram, called from the receive task
+ */
+void hci_bench_handle(uint8_t *data, int len);
+
+#ifdef __cplusplus
+}
+#endif
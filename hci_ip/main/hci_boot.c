@@ -0,0 +1,46 @@
+/* HCI-IP boot timeline
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdatomic.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "hci_boot.h"
+
+static const char *TAG = "HCI_BOOT";
+
+static const char *s_names[HCI_BOOT_STAGE_NUM] = {
+    [HCI_BOOT_BT_ENABLED] = "controller enabled",
+    [HCI_BOOT_HCI_RESET] = "controller reset",
+    [HCI_BOOT_SOCKET] = "socket bound",
+    [HCI_BOOT_NETWORK] = "network up",
+    [HCI_BOOT_READY] = "ready",
+    [HCI_BOOT_FIRST_HOST_PKT] = "first host packet",
+};
+
+static atomic_uint s_ms[HCI_BOOT_STAGE_NUM];
+
+void hci_boot_mark(hci_boot_stage_t stage)
+{
+    // cheap enough for the packet path once the milestone is set
+    if (stage >= HCI_BOOT_STAGE_NUM || atomic_load_explicit(&s_ms[stage], memory_order_relaxed))
+        return;
+
+    // 0 means not reached, so the first millisecond counts as 1
+    unsigned int expected = 0;
+    uint32_t ms = esp_timer_get_time() / 1000;
+    if (ms == 0)
+        ms = 1;
+    if (atomic_compare_exchange_strong(&s_ms[stage], &expected, ms))
+        ESP_LOGI(TAG, "%s after %" PRIu32 " ms", s_names[stage], ms);
+}
+
+uint32_t hci_boot_ms(hci_boot_stage_t stage)
+{
+    return stage < HCI_BOOT_STAGE_NUM ? atomic_load(&s_ms[stage]) : 0;
+}
@@ -0,0 +1,46 @@
+/* HCI-IP boot timeline
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Milestones from power-up to the first host packet. Each one is logged
+ * once, in milliseconds since esp_timer started (the bootloader is not
+ * included), the first time it is reached.
+ */
+typedef enum {
+    HCI_BOOT_BT_ENABLED = 0,    /* esp_bt_controller_enable() returned */
+    HCI_BOOT_HCI_RESET,         /* Command Complete for the warm-up HCI Reset */
+    HCI_BOOT_SOCKET,            /* host socket bound */
+    HCI_BOOT_NETWORK,           /* example_connect() returned, IP acquired */
+    HCI_BOOT_READY,             /* controller and network both up */
+    HCI_BOOT_FIRST_HOST_PKT,    /* first H4 packet from the host */
+    HCI_BOOT_STAGE_NUM,
+} hci_boot_stage_t;
+
+/*
+ * @brief: Record a milestone, later calls for the same one are ignored.
+ *         Safe to call from any task
+ */
+void hci_boot_mark(hci_boot_stage_t stage);
+
+/*
+ * @brief: When a milestone was reached, 0 if not yet
+ */
+uint32_t hci_boot_ms(hci_boot_stage_t stage);
+
+#ifdef __cplusplus
+}
+#endif
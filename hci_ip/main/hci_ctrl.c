@@ -0,0 +1,118 @@
+/* HCI-IP control channel
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdatomic.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "hci_proto.h"
+#include "hci_ctrl.h"
+#include "hci_rel.h"
+#include "hci_lat.h"
+
+static const char *TAG = "HCI_CTRL";
+
+// written by the UDP receive task, read by the upstream task
+static atomic_uint s_features;
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static int handle_hello(const uint8_t *payload, int len, uint8_t *rsp, int rsp_size)
+{
+    if (len < 4 || rsp_size < 8) {
+        ESP_LOGE(TAG, "Malformed HELLO, len %d", len);
+        return 0;
+    }
+
+    uint32_t requested = get_le32(payload);
+    uint32_t granted = requested & HCI_IP_FEAT_SUPPORTED;
+#ifdef CONFIG_HCI_IP_RELIABLE
+    // every HELLO starts a new session, sequence numbers restart at 0
+    if (granted & HCI_IP_FEAT_RELIABLE)
+        hci_rel_reset();
+#endif
+    atomic_store(&s_features, granted);
+    ESP_LOGI(TAG, "Host requested features 0x%08" PRIx32 ", granted 0x%08" PRIx32, requested, granted);
+
+    rsp[0] = HCI_IP_PKT_CTRL;
+    rsp[1] = HCI_IP_CTRL_HELLO_RSP;
+    put_le32(&rsp[2], granted);
+    rsp[6] = CONFIG_HCI_IP_BUNDLE_MTU & 0xff;
+    rsp[7] = CONFIG_HCI_IP_BUNDLE_MTU >> 8;
+    return 8;
+}
+
+#ifdef CONFIG_HCI_IP_LATENCY
+static int handle_lat_get(const uint8_t *payload, int len, uint8_t *rsp, int rsp_size)
+{
+    hci_lat_hist_t hist;
+
+    if (len < 2 || rsp_size < 20 + 4 * HCI_LAT_BUCKETS || !hci_lat_get(payload[0], payload[1], &hist)) {
+        ESP_LOGE(TAG, "Malformed LAT_GET, len %d", len);
+        return 0;
+    }
+
+    rsp[0] = HCI_IP_PKT_CTRL;
+    rsp[1] = HCI_IP_CTRL_LAT_RSP;
+    rsp[2] = payload[0];
+    rsp[3] = payload[1];
+    put_le32(&rsp[4], hist.count);
+    put_le32(&rsp[8], hist.max_us);
+    put_le32(&rsp[12], (uint32_t)hist.sum_us);
+    put_le32(&rsp[16], (uint32_t)(hist.sum_us >> 32));
+    for (int i = 0; i < HCI_LAT_BUCKETS; i++)
+        put_le32(&rsp[20 + 4 * i], hist.buckets[i]);
+    return 20 + 4 * HCI_LAT_BUCKETS;
+}
+#endif
+
+int hci_ctrl_handle(const uint8_t *pkt, int len, uint8_t *rsp, int rsp_size)
+{
+    if (len < 2)
+        return 0;
+
+    switch (pkt[1])
+    {
+      case HCI_IP_CTRL_HELLO:
+        return handle_hello(&pkt[2], len - 2, rsp, rsp_size);
+#ifdef CONFIG_HCI_IP_LATENCY
+      case HCI_IP_CTRL_LAT_GET:
+        return handle_lat_get(&pkt[2], len - 2, rsp, rsp_size);
+      case HCI_IP_CTRL_LAT_RESET:
+        hci_lat_reset();
+        return 0;
+#endif
+      case HCI_IP_CTRL_BYE:
+        hci_ctrl_reset();
+        return 0;
+      default:
+        ESP_LOGW(TAG, "Unknown control op 0x%02x", pkt[1]);
+        return 0;
+    }
+}
+
+uint32_t hci_ctrl_features(void)
+{
+    return atomic_load_explicit(&s_features, memory_order_relaxed);
+}
+
+void hci_ctrl_reset(void)
+{
+    atomic_store(&s_features, 0);
+}
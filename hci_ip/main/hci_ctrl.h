@@ -0,0 +1,38 @@
+/* HCI-IP control channel
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * @brief: Handle one HCI_IP_PKT_CTRL packet received from the host
+ * params: rsp: buffer for the reply, sent back to the host by the caller
+ * return: reply length, 0 if there is nothing to send back
+ */
+int hci_ctrl_handle(const uint8_t *pkt, int len, uint8_t *rsp, int rsp_size);
+
+/*
+ * @brief: Features currently enabled by the host, HCI_IP_FEAT_* bits
+ */
+uint32_t hci_ctrl_features(void);
+
+/*
+ * @brief: Drop back to legacy framing, used when the host goes away
+ */
+void hci_ctrl_reset(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,208 @@
+/* HCI-IP host to controller queue
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_bt.h"
+#include "hci_proto.h"
+#include "hci_h2c.h"
+#include "hci_lat.h"
+#include "hci_snoop.h"
+
+#define H2C_DEPTH           CONFIG_HCI_IP_H2C_QUEUE_DEPTH
+#define H2C_CMD_RESERVED    2
+// a whole datagram fits, so the receive task can read straight into a slot
+#define H2C_SLOT_SIZE       HCI_IP_MAX_DGRAM_SIZE
+
+typedef struct {
+    uint8_t idx[H2C_DEPTH];
+    uint8_t head;
+    uint8_t count;
+} h2c_fifo_t;
+
+typedef struct {
+    uint16_t len;
+    uint16_t off;           // packet start, datagram headers may precede it
+    uint32_t rx_stamp;
+    uint32_t enq_stamp;
+    uint8_t data[H2C_SLOT_SIZE];
+} h2c_slot_t;
+
+static const char *TAG = "HCI_H2C";
+
+static h2c_slot_t *s_slots;
+static uint8_t s_rx_slot;       // receive buffer of the UDP receive task, in no fifo
+static h2c_fifo_t s_free;
+static h2c_fifo_t s_cmd;
+static h2c_fifo_t s_data;
+static SemaphoreHandle_t s_lock;
+static SemaphoreHandle_t s_space;
+static hci_h2c_stats_t s_stats;
+static bool s_batch;            // receive task is in a batch, it drains at the end
+
+static void fifo_put(h2c_fifo_t *f, uint8_t slot)
+{
+    f->idx[(f->head + f->count) % H2C_DEPTH] = slot;
+    f->count++;
+}
+
+static uint8_t fifo_get(h2c_fifo_t *f)
+{
+    uint8_t slot = f->idx[f->head];
+    f->head = (f->head + 1) % H2C_DEPTH;
+    f->count--;
+    return slot;
+}
+
+esp_err_t hci_h2c_init(void)
+{
+    s_slots = calloc(H2C_DEPTH + 1, sizeof(h2c_slot_t));
+    s_lock = xSemaphoreCreateMutex();
+    s_space = xSemaphoreCreateBinary();
+    if (!s_slots || !s_lock || !s_space) {
+        ESP_LOGE(TAG, "Unable to allocate H2C queue");
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (uint8_t i = 0; i < H2C_DEPTH; i++)
+        fifo_put(&s_free, i);
+    s_rx_slot = H2C_DEPTH;
+    return ESP_OK;
+}
+
+/* must be called with s_lock held */
+static void drain_locked(void)
+{
+    bool freed = false;
+
+    while (s_cmd.count + s_data.count > 0 && esp_vhci_host_check_send_available()) {
+        // commands gate the host's next step, send them ahead of data
+        uint8_t slot = s_cmd.count ? fifo_get(&s_cmd) : fifo_get(&s_data);
+        h2c_slot_t *entry = &s_slots[slot];
+        uint8_t *pkt = &entry->data[entry->off];
+        esp_vhci_host_send_packet(pkt, entry->len);
+        hci_snoop_capture(HCI_SNOOP_H2C, pkt, entry->len);
+        uint32_t now = hci_lat_now();
+        hci_lat_record(HCI_LAT_H2C_QUEUE, pkt[0], entry->enq_stamp, now);
+        hci_lat_record(HCI_LAT_H2C_TOTAL, pkt[0], entry->rx_stamp, now);
+        s_stats.sent++;
+        if (pkt[0] < 6) {
+            s_stats.pkts[pkt[0]]++;
+            s_stats.bytes[pkt[0]] += entry->len;
+        }
+        fifo_put(&s_free, slot);
+        freed = true;
+    }
+
+    if (freed)
+        xSemaphoreGive(s_space);
+}
+
+bool hci_h2c_enqueue(const uint8_t *data, uint16_t len, uint32_t rx_stamp, TickType_t wait)
+{
+    uint32_t enq_stamp = hci_lat_now();
+
+    if (len == 0 || len > HCI_IP_MAX_PKT_SIZE) {
+        s_stats.oversize++;
+        return false;
+    }
+
+    bool is_cmd = data[0] == H4_TYPE_COMMAND;
+    // leave a few slots that only commands can take
+    uint8_t min_free = is_cmd ? 1 : H2C_CMD_RESERVED + 1;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    while (s_free.count < min_free) {
+        drain_locked();
+        if (s_free.count >= min_free)
+            break;
+
+        xSemaphoreGive(s_lock);
+        if (wait == 0 || xSemaphoreTake(s_space, wait) != pdTRUE) {
+            s_stats.dropped++;
+            ESP_LOGE(TAG, "H2C queue full, dropping %s packet", is_cmd ? "command" : "data");
+            return false;
+        }
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+    }
+
+    // a packet received into the receive buffer is queued as is, the
+    // receive task carries on in a free slot
+    uint8_t *rx = s_slots[s_rx_slot].data;
+    uint8_t slot;
+    if (data >= rx && data + len <= rx + H2C_SLOT_SIZE) {
+        slot = s_rx_slot;
+        s_rx_slot = fifo_get(&s_free);
+        s_slots[slot].off = data - rx;
+        s_stats.zero_copy++;
+    } else {
+        slot = fifo_get(&s_free);
+        memcpy(s_slots[slot].data, data, len);
+        s_slots[slot].off = 0;
+        s_stats.copied_bytes += len;
+    }
+    s_slots[slot].len = len;
+    s_slots[slot].rx_stamp = rx_stamp;
+    s_slots[slot].enq_stamp = enq_stamp;
+    fifo_put(is_cmd ? &s_cmd : &s_data, slot);
+
+    s_stats.enqueued++;
+    uint32_t depth = s_cmd.count + s_data.count;
+    if (depth > s_stats.high_water)
+        s_stats.high_water = depth;
+
+    if (!s_batch)
+        drain_locked();
+    xSemaphoreGive(s_lock);
+    return true;
+}
+
+void hci_h2c_batch_begin(void)
+{
+    s_batch = true;
+}
+
+void hci_h2c_batch_end(uint16_t count)
+{
+    s_batch = false;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (count) {
+        // bucket i holds batches of 2^i to 2^(i+1) - 1 datagrams
+        int bucket = 31 - __builtin_clz(count);
+        if (bucket >= HCI_H2C_BATCH_BUCKETS)
+            bucket = HCI_H2C_BATCH_BUCKETS - 1;
+        s_stats.batch[bucket]++;
+    }
+    drain_locked();
+    xSemaphoreGive(s_lock);
+}
+
+uint8_t *hci_h2c_rx_buffer(uint16_t *size)
+{
+    // only hci_h2c_enqueue() from the same task replaces it
+    *size = H2C_SLOT_SIZE;
+    return s_slots[s_rx_slot].data;
+}
+
+void hci_h2c_drain(void)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    drain_locked();
+    xSemaphoreGive(s_lock);
+}
+
+void hci_h2c_get_stats(hci_h2c_stats_t *stats)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    *stats = s_stats;
+    stats->depth = s_cmd.count + s_data.count;
+    xSemaphoreGive(s_lock);
+}
@@ -0,0 +1,92 @@
+/* HCI-IP host to controller queue
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Bounded queue in front of esp_vhci_host_send_packet(). Packets are held
+ * while the controller has no free buffer and are drained again when the
+ * controller signals it is ready. HCI commands are always sent before
+ * queued ACL/SCO data, and a few slots are reserved for them so a data
+ * burst cannot lock commands out.
+ */
+
+#define HCI_H2C_BATCH_BUCKETS   6
+
+typedef struct {
+    uint32_t enqueued;      /* packets accepted into the queue */
+    uint32_t sent;          /* packets handed to the controller */
+    uint32_t dropped;       /* packets dropped because the queue stayed full (controller busy) */
+    uint32_t oversize;      /* packets dropped because they do not fit a slot */
+    uint32_t zero_copy;     /* packets queued in the buffer they were received into */
+    uint32_t copied_bytes;  /* bytes copied into a slot, all other packets */
+    uint32_t depth;         /* packets currently queued */
+    uint32_t high_water;    /* max packets ever queued at once */
+    uint32_t pkts[6];       /* packets handed to the controller, indexed by H4 type */
+    uint32_t bytes[6];      /* bytes handed to the controller, indexed by H4 type */
+    uint32_t batch[HCI_H2C_BATCH_BUCKETS];  /* receive wakeups by datagrams read, 1, 2-3, 4-7, ... */
+} hci_h2c_stats_t;
+
+/*
+ * @brief: Allocate the queue slots, must be called before any other hci_h2c_* function
+ */
+esp_err_t hci_h2c_init(void);
+
+/*
+ * @brief: Buffer for the UDP receive task to read the next datagram into.
+ *         An H4 packet inside it is queued without a copy and the task gets
+ *         a different buffer, so ask again before every receive
+ * params: size: buffer size, room for the largest sealed reliable frame
+ */
+uint8_t *hci_h2c_rx_buffer(uint16_t *size);
+
+/*
+ * @brief: Queue one H4 packet and try to send it right away. It is copied
+ *         into a slot unless it lies in the hci_h2c_rx_buffer() buffer
+ * params: rx_stamp: hci_lat_now() when the packet left the socket
+ * params: wait: ticks to wait for a free slot when the queue is full
+ * return: false if the packet was dropped
+ */
+bool hci_h2c_enqueue(const uint8_t *data, uint16_t len, uint32_t rx_stamp, TickType_t wait);
+
+/*
+ * @brief: Hold the packets queued from here on until hci_h2c_batch_end(),
+ *         so a burst read in one receive wakeup goes to the controller in
+ *         one go. A full queue is still drained right away
+ */
+void hci_h2c_batch_begin(void);
+
+/*
+ * @brief: Send the packets held since hci_h2c_batch_begin()
+ * params: count: datagrams read in this wakeup, for the batch histogram
+ */
+void hci_h2c_batch_end(uint16_t count);
+
+/*
+ * @brief: Send queued packets for as long as the controller accepts them
+ */
+void hci_h2c_drain(void);
+
+/*
+ * @brief: Snapshot of the queue counters
+ */
+void hci_h2c_get_stats(hci_h2c_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
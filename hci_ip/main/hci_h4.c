@@ -0,0 +1,108 @@
+/* HCI-IP H4 packet parser
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include "hci_proto.h"
+#include "hci_h4.h"
+
+typedef struct {
+    uint8_t hdr_len;
+    uint8_t len_off;        /* offset of the length field inside the header */
+    uint8_t len_size;       /* 1 or 2 bytes, little endian */
+    uint16_t len_mask;
+    uint16_t max_payload;
+} h4_desc_t;
+
+// indexed by H4 type, hdr_len 0 marks an unknown type
+static const h4_desc_t s_desc[6] = {
+    [H4_TYPE_COMMAND] = { 3, 2, 1, 0x00ff, HCI_IP_MAX_CMD_PARAM_LEN },
+    [H4_TYPE_ACL]     = { 4, 2, 2, 0xffff, HCI_IP_MAX_ACL_DATA_LEN },
+    [H4_TYPE_SCO]     = { 3, 2, 1, 0x00ff, HCI_IP_MAX_SCO_DATA_LEN },
+    [H4_TYPE_EVENT]   = { 2, 1, 1, 0x00ff, HCI_IP_MAX_EVT_PARAM_LEN },
+    [H4_TYPE_ISO]     = { 4, 2, 2, 0x3fff, HCI_IP_MAX_ACL_DATA_LEN },
+};
+
+// single writer per direction: the receive task for H2C, the controller for C2H
+static hci_h4_stats_t s_stats[HCI_H4_DIR_MAX];
+
+hci_h4_status_t hci_h4_parse(const uint8_t *buf, size_t len, hci_h4_pkt_t *pkt)
+{
+    if (len < 1)
+        return HCI_H4_NEED_MORE;
+
+    uint8_t type = buf[0];
+    if (type >= sizeof(s_desc) / sizeof(s_desc[0]) || s_desc[type].hdr_len == 0)
+        return HCI_H4_BAD_TYPE;
+
+    const h4_desc_t *d = &s_desc[type];
+    if (len < 1u + d->hdr_len)
+        return HCI_H4_NEED_MORE;
+
+    const uint8_t *hdr = &buf[1];
+    uint16_t payload_len = hdr[d->len_off];
+    if (d->len_size == 2)
+        payload_len |= hdr[d->len_off + 1] << 8;
+    payload_len &= d->len_mask;
+
+    if (payload_len > d->max_payload)
+        return HCI_H4_TOO_LONG;
+
+    pkt->type = type;
+    pkt->hdr_len = d->hdr_len;
+    pkt->payload_len = payload_len;
+    pkt->total_len = 1 + d->hdr_len + payload_len;
+    pkt->hdr = hdr;
+    pkt->payload = &hdr[d->hdr_len];
+
+    if (len < pkt->total_len)
+        return HCI_H4_NEED_MORE;
+    return HCI_H4_OK;
+}
+
+void hci_h4_count(hci_h4_dir_t dir, hci_h4_status_t status, uint8_t type)
+{
+    hci_h4_stats_t *st = &s_stats[dir];
+
+    switch (status)
+    {
+      case HCI_H4_OK:
+        st->ok[type]++;
+        break;
+      case HCI_H4_BAD_TYPE:
+        st->bad_type++;
+        break;
+      case HCI_H4_TOO_LONG:
+        st->too_long++;
+        break;
+      case HCI_H4_NEED_MORE:
+      case HCI_H4_TRUNCATED:
+        st->truncated++;
+        break;
+      case HCI_H4_TRAILING:
+        st->trailing++;
+        break;
+    }
+}
+
+hci_h4_status_t hci_h4_validate(hci_h4_dir_t dir, const uint8_t *buf, size_t len, hci_h4_pkt_t *pkt)
+{
+    hci_h4_status_t status = hci_h4_parse(buf, len, pkt);
+
+    // a datagram is complete by definition, a short one was truncated on the way
+    if (status == HCI_H4_NEED_MORE)
+        status = HCI_H4_TRUNCATED;
+    else if (status == HCI_H4_OK && len > pkt->total_len)
+        status = HCI_H4_TRAILING;
+
+    hci_h4_count(dir, status, len ? buf[0] : 0);
+    return status;
+}
+
+void hci_h4_get_stats(hci_h4_dir_t dir, hci_h4_stats_t *stats)
+{
+    *stats = s_stats[dir];
+}
@@ -0,0 +1,81 @@
+/* HCI-IP H4 packet parser
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Zero-copy H4 parser shared by both directions and all transports. It only
+ * looks at the type byte and the HCI header, the returned packet points into
+ * the caller's buffer. It has no ESP-IDF dependencies so it also builds for
+ * the linux target.
+ */
+
+typedef enum {
+    HCI_H4_OK = 0,
+    HCI_H4_NEED_MORE,       /* stream only: packet not complete yet */
+    HCI_H4_BAD_TYPE,        /* first byte is not an H4 packet type */
+    HCI_H4_TOO_LONG,        /* header announces more than the controller supports */
+    HCI_H4_TRUNCATED,       /* datagram shorter than its header announces */
+    HCI_H4_TRAILING,        /* datagram longer than its header announces */
+} hci_h4_status_t;
+
+typedef enum {
+    HCI_H4_DIR_H2C = 0,     /* host to controller */
+    HCI_H4_DIR_C2H,         /* controller to host */
+    HCI_H4_DIR_MAX,
+} hci_h4_dir_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t hdr_len;        /* HCI header length after the type byte */
+    uint16_t payload_len;
+    uint16_t total_len;     /* type byte + header + payload */
+    const uint8_t *hdr;
+    const uint8_t *payload;
+} hci_h4_pkt_t;
+
+typedef struct {
+    uint32_t ok[6];         /* valid packets, indexed by H4 type */
+    uint32_t bad_type;
+    uint32_t too_long;
+    uint32_t truncated;
+    uint32_t trailing;
+} hci_h4_stats_t;
+
+/*
+ * @brief: Parse the packet at the start of a byte stream
+ * return: HCI_H4_NEED_MORE until len covers the whole packet
+ */
+hci_h4_status_t hci_h4_parse(const uint8_t *buf, size_t len, hci_h4_pkt_t *pkt);
+
+/*
+ * @brief: Validate a datagram that must hold exactly one H4 packet and count the result
+ */
+hci_h4_status_t hci_h4_validate(hci_h4_dir_t dir, const uint8_t *buf, size_t len, hci_h4_pkt_t *pkt);
+
+/*
+ * @brief: Count the result of a stream parse done with hci_h4_parse()
+ */
+void hci_h4_count(hci_h4_dir_t dir, hci_h4_status_t status, uint8_t type);
+
+/*
+ * @brief: Snapshot of the parser counters for one direction
+ */
+void hci_h4_get_stats(hci_h4_dir_t dir, hci_h4_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -10,8 +10,11 @@
 #include <sys/param.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "esp_system.h"
+#if !CONFIG_IDF_TARGET_LINUX
 #include "esp_wifi.h"
+#endif
 #include "esp_event.h"
 #include "esp_log.h"
 #include "nvs_flash.h"
@@ -25,26 +28,46 @@
 
 #include "esp_err.h"
 
+// on the linux target esp_bt.h comes from the vhci_mock component
 #include "esp_bt.h"
+#if !CONFIG_IDF_TARGET_LINUX
 #include "soc/uhci_periph.h"
 #include "esp_private/periph_ctrl.h" // for enabling UHCI module, remove it after UHCI driver is released
+#endif
 
-//#define HCI_PROTO_DEBUG 1
-#define HCI_PROTO_TEST 1
-
-extern esp_err_t do_console_provision(bool, bool);
+#include "hci_proto.h"
+#include "hci_h2c.h"
+#include "hci_ctrl.h"
+#include "hci_uplink.h"
+#include "hci_tcp.h"
+#include "hci_rel.h"
+#include "hci_h4.h"
+#include "hci_lat.h"
+#include "hci_metrics.h"
+#include "hci_bench.h"
+#include "hci_session.h"
+#include "hci_udp_raw.h"
+#include "hci_task.h"
+#include "hci_prov.h"
+#include "hci_boot.h"
+#include "hci_ps.h"
+#include "hci_aead.h"
+#include "hci_snoop.h"
 
-static const int RX_BUF_SIZE = 1024;
 static const char *TAG = "HCI-IP";
 static const char *tag = "CONTROLLER_HCI-IP";
 
-static volatile int c_sock;
-static volatile struct sockaddr_storage c_source_addr; // Large enough for both IPv4 or IPv6
+static TaskHandle_t h2c_tx_handle;
+static TaskHandle_t s_boot_task;
+static SemaphoreHandle_t s_warmup_done;
+static volatile bool s_warmup_pending;  // the boot HCI Reset has not completed yet
+static uint32_t s_rx_stamp;     // hci_lat_now() of the datagram being dispatched, UDP receive task only
 
 /*
  * @brief: Show reset reason 
  */
 
+#if !CONFIG_IDF_TARGET_LINUX
 void show_reset_reason()
 {
     esp_reset_reason_t rst_r = esp_reset_reason();
@@ -93,6 +116,7 @@ void show_reset_reason()
         ESP_LOGE(tag, "Unknown source");
     }
 }
+#endif
 
 /*
  * @brief: BT controller callback function, used to notify the upper layer that
@@ -100,7 +124,9 @@ void show_reset_reason()
  */
 static void controller_rcv_pkt_ready(void)
 {
-    //printf("controller rcv pkt ready\n");
+    // queued host packets are sent from h2c_tx_task(), not from controller context
+    if (h2c_tx_handle)
+        xTaskNotifyGive(h2c_tx_handle);
 }
 
 /*
@@ -110,34 +136,33 @@ static void controller_rcv_pkt_ready(void)
 /*
 */
 
-static const char *RX_HCI_CB = "RX_HCI_CB";
+static bool is_reset_complete(const uint8_t *data, uint16_t len)
+{
+    // [0x04][0x0e][plen][num cmds][opcode 0x0c03]
+    return len >= 6 && data[0] == 0x04 && data[1] == 0x0e && data[4] == 0x03 && data[5] == 0x0c;
+}
 
 static int host_rcv_pkt(uint8_t *data, uint16_t len)
 {
-    if (len > 0 && len < RX_BUF_SIZE)
-    {
-      int txBytes = 0;
-      do
-      {
-        txBytes = sendto(c_sock, &data[txBytes], len, 0, (struct sockaddr *)&c_source_addr, sizeof(c_source_addr));
-        if (txBytes < 0) {
-          ESP_LOGE(RX_HCI_CB, "Error occurred during sendto: errno %d", errno);
-          return -1;
-        }
-#ifdef HCI_PROTO_DEBUG
-        else if (txBytes < len)
-          ESP_LOGI(RX_HCI_CB, "More data to send upstream UDP: %i, %i", txBytes, len);
-        else
-          ESP_LOGI(RX_HCI_CB, "Data sent finished UDP: %i", len);
-
-        ESP_LOGI(RX_HCI_CB, "Last data: len: %i, txBytes: %i", len, txBytes);
-        ESP_LOG_BUFFER_HEXDUMP(RX_HCI_CB, data, len, ESP_LOG_INFO);
-#endif
-        len -= txBytes;
-      } while (len > 0);
+    uint32_t stamp = hci_lat_now();
+    hci_h4_pkt_t pkt;
+
+    // the answer to the boot-time reset is not for the host
+    if (s_warmup_pending && is_reset_complete(data, len)) {
+        s_warmup_pending = false;
+        xSemaphoreGive(s_warmup_done);
+        return 0;
     }
- 
-    return 0;
+
+    hci_snoop_capture(HCI_SNOOP_C2H, data, len);
+
+    // malformed controller packets are counted and never reach the host
+    if (hci_h4_validate(HCI_H4_DIR_C2H, data, len, &pkt) != HCI_H4_OK)
+      return -1;
+    hci_ps_c2h(&pkt);
+
+    // runs in controller context: only queue the packet, the upstream task does the socket write
+    return hci_uplink_put(data, len, stamp);
 }
 
 static esp_vhci_host_callback_t vhci_host_cb = {
@@ -147,16 +172,195 @@ static esp_vhci_host_callback_t vhci_host_cb = {
 
 #define PORT                        CONFIG_HCI_IP_PORT
 
+#define SESSION_IDLE_S              CONFIG_HCI_IP_SESSION_IDLE_S
+#define WARMUP_TIMEOUT_MS           1000
+#ifdef CONFIG_HCI_IP_RX_BATCH
+#define RX_BATCH                    CONFIG_HCI_IP_RX_BATCH
+#else
+#define RX_BATCH                    1
+#endif
+
+/*
+ * @brief: Upstream transport for hci_uplink, one datagram per call
+ */
+static int udp_send_upstream(const uint8_t *data, uint16_t len)
+{
+    return hci_session_send(data, len);
+}
+
+/*
+ * @brief: Upstream transport for hci_uplink, one datagram gathered from iov
+ */
+static int udp_sendv_upstream(const struct iovec *iov, int iovcnt)
+{
+    return hci_session_sendv(iov, iovcnt);
+}
+
+/*
+ * @brief: Resume sending queued host packets once the controller is ready again
+ */
+static void h2c_tx_task(void *pvParameters)
+{
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        hci_h2c_drain();
+    }
+}
+
+/*
+ * @brief: Dispatch one host datagram: benchmark, proxy control or H4 packet
+ */
+static void handle_datagram(uint8_t *data, int len)
+{
+#ifdef HCI_PROTO_TEST
+    // benchmark and legacy echo, answered on the socket
+    if (data[0] == HCI_IP_PKT_TEST)
+    {
+      hci_bench_handle(data, len);
+      return;
+    }
+#endif
+
+    // proxy control, e.g. framing negotiation, never reaches the controller
+    if (data[0] == HCI_IP_PKT_CTRL)
+    {
+      uint8_t rsp[HCI_IP_CTRL_RSP_MAX];
+      int rsp_len = hci_ctrl_handle(data, len, rsp, sizeof(rsp));
+      if (rsp_len > 0)
+        hci_session_send(rsp, rsp_len);
+      // the host is done, the next datagram from any host starts a new session
+      if (len >= 2 && data[1] == HCI_IP_CTRL_BYE)
+      {
+        hci_session_close(false);
+#ifdef CONFIG_HCI_IP_AEAD
+        // the next host, or this one again, has to do a new handshake
+        hci_aead_reset();
+#endif
+      }
+      return;
+    }
+
+    hci_h4_pkt_t pkt;
+    hci_h4_status_t status = hci_h4_validate(HCI_H4_DIR_H2C, data, len, &pkt);
+    if (status != HCI_H4_OK)
+    {
+      ESP_LOGW(TAG, "Dropping malformed H4 datagram (%d), type 0x%02x, len %d", status, data[0], len);
+      return;
+    }
+    hci_boot_mark(HCI_BOOT_FIRST_HOST_PKT);
+    hci_ps_h2c(&pkt);
+
+    // held in the H2C queue while the controller is busy
+    hci_h2c_enqueue(data, len, s_rx_stamp, pdMS_TO_TICKS(CONFIG_HCI_IP_H2C_FULL_WAIT_MS));
+}
+
+#ifdef CONFIG_HCI_IP_AEAD
+/*
+ * @brief: With a link key only the handshake is accepted in the clear. Runs
+ *         before the session is given to the sender, so that only a host
+ *         holding the key can take it over
+ * params: rsp_len: set to the length of the AUTH_RSP in rsp, to be sent back
+ *         to the sender in the clear
+ * return: length of the datagram left at *data, 0 if there is nothing to dispatch
+ */
+static int open_datagram(uint8_t **data, int len, uint8_t *rsp, int *rsp_len)
+{
+    *rsp_len = 0;
+    if (!hci_aead_enabled())
+      return len;
+    if ((*data)[0] == HCI_IP_PKT_AUTH)
+    {
+      *rsp_len = hci_aead_auth(*data, len, rsp, HCI_IP_AUTH_RSP_LEN);
+      return 0;
+    }
+    return hci_aead_open(*data, len, data);
+}
+#endif
+
+/*
+ * @brief: Entry point for every host datagram, whichever UDP backend received it
+ */
+static void dispatch_datagram(uint8_t *data, int len)
+{
+#ifdef CONFIG_HCI_IP_RELIABLE
+    // sequenced frames are unwrapped and delivered in order, acks free upstream slots
+    if (data[0] == HCI_IP_PKT_REL_DATA || data[0] == HCI_IP_PKT_REL_ACK)
+    {
+      hci_rel_input(data, len, handle_datagram);
+      return;
+    }
+#endif
+
+    handle_datagram(data, len);
+}
+
+#ifdef CONFIG_HCI_IP_UDP_RAW
+/*
+ * @brief: Dispatch host datagrams queued by the raw lwIP backend
+ */
+static void udp_raw_task(void *pvParameters)
+{
+    static const char *RX_TASK_TAG = "UDP_RAW_TASK";
+    TickType_t idle = SESSION_IDLE_S ? pdMS_TO_TICKS(SESSION_IDLE_S * 1000) : portMAX_DELAY;
+
+    if (hci_udp_raw_start() != ESP_OK) {
+        ESP_LOGE(RX_TASK_TAG, "Unable to start the raw UDP backend");
+        vTaskDelete(NULL);
+        return;
+    }
+    hci_boot_mark(HCI_BOOT_SOCKET);
+
+    while (1) {
+        // block for the first datagram, then take whatever else is already queued
+        TickType_t wait = idle;
+        uint16_t batch = 0;
+
+        hci_h2c_batch_begin();
+        while (batch < RX_BATCH) {
+            uint8_t *data;
+            bool new_host;
+            int len = hci_udp_raw_recv(&data, &s_rx_stamp, wait);
+            if (len == 0) {
+                // a full idle period without a datagram from the session host
+                if (batch == 0)
+                    hci_session_close(true);
+                break;
+            }
+            wait = 0;
+            batch++;
+#ifdef CONFIG_HCI_IP_AEAD
+            uint8_t rsp[HCI_IP_AUTH_RSP_LEN];
+            int rsp_len;
+            len = open_datagram(&data, len, rsp, &rsp_len);
+            // the handshake answer goes to its sender, the session stays where it is
+            if (rsp_len > 0)
+                hci_udp_raw_reply(rsp, rsp_len);
+            if (len == 0)
+                continue;
+#endif
+            // the first datagram while idle decides who owns the pcb,
+            // features negotiated by a previous host do not carry over
+            if (!hci_udp_raw_accept(&new_host))
+                continue;
+            if (new_host)
+                hci_ctrl_reset();
+#ifdef HCI_PROTO_DEBUG
+            ESP_LOGI(RX_TASK_TAG, "Received %d bytes", len);
+            ESP_LOG_BUFFER_HEXDUMP(RX_TASK_TAG, data, len, ESP_LOG_INFO);
+#endif
+            dispatch_datagram(data, len);
+        }
+        hci_h2c_batch_end(batch);
+    }
+}
+#else
 static void udp_server_task(void *pvParameters)
 {
     static const char *RX_TASK_TAG = "UDP_RX_TASK";
-    uint8_t* rx_buffer = (uint8_t*) malloc(RX_BUF_SIZE + 1);
     int addr_family = AF_INET;
     int ip_protocol = 0;
     struct sockaddr_in6 dest_addr;
-
-    /* Register the callbacks used by controller */
-    esp_vhci_host_register_callback(&vhci_host_cb);
+    struct sockaddr_storage source_addr; // Large enough for both IPv4 or IPv6
 
     while (1) {
 
@@ -173,8 +377,8 @@ static void udp_server_task(void *pvParameters)
             ip_protocol = IPPROTO_IPV6;
         }
 
-        c_sock = socket(addr_family, SOCK_DGRAM, ip_protocol);
-        if (c_sock < 0) {
+        int sock = socket(addr_family, SOCK_DGRAM, ip_protocol);
+        if (sock < 0) {
             ESP_LOGE(RX_TASK_TAG, "Unable to create socket: errno %d", errno);
             break;
         }
@@ -182,7 +386,7 @@ static void udp_server_task(void *pvParameters)
 
 #if defined(CONFIG_LWIP_NETBUF_RECVINFO) && !defined(CONFIG_EXAMPLE_IPV6)
         int enable = 1;
-        lwip_setsockopt(c_sock, IPPROTO_IP, IP_PKTINFO, &enable, sizeof(enable));
+        lwip_setsockopt(sock, IPPROTO_IP, IP_PKTINFO, &enable, sizeof(enable));
 #endif
 
 #if defined(CONFIG_HCI_IP_IPV4) && defined(CONFIG_EXAMPLE_IPV6)
@@ -190,18 +394,26 @@ static void udp_server_task(void *pvParameters)
             // Note that by default IPV6 binds to both protocols, it is must be disabled
             // if both protocols used at the same time (used in CI)
             int opt = 1;
-            setsockopt(c_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-            setsockopt(c_sock, IPPROTO_IPV6, IPV6_V6ONLY, &opt, sizeof(opt));
+            setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+            setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &opt, sizeof(opt));
         }
 #endif
 
-        int err = bind(c_sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
+        int err = bind(sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
         if (err < 0) {
             ESP_LOGE(RX_TASK_TAG, "Socket unable to bind: errno %d", errno);
         }
         ESP_LOGI(RX_TASK_TAG, "Socket bound, port %d", PORT);
+        hci_boot_mark(HCI_BOOT_SOCKET);
 
-        socklen_t c_socklen = sizeof(c_source_addr);
+#if SESSION_IDLE_S
+        // wake up periodically to release a session whose host went silent
+        struct timeval idle = { .tv_sec = SESSION_IDLE_S };
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
+#endif
+        hci_session_attach(sock);
+
+        socklen_t source_len;
 
 #if defined(CONFIG_LWIP_NETBUF_RECVINFO) && !defined(CONFIG_EXAMPLE_IPV6)
         struct iovec iov;
@@ -209,111 +421,164 @@ static void udp_server_task(void *pvParameters)
         struct cmsghdr *cmsgtmp;
         u8_t cmsg_buf[CMSG_SPACE(sizeof(struct in_pktinfo))];
 
-        iov.iov_base = rx_buffer;
-        iov.iov_len = sizeof(rx_buffer);
         msg.msg_control = cmsg_buf;
-        msg.msg_controllen = sizeof(cmsg_buf);
-        msg.msg_flags = 0;
         msg.msg_iov = &iov;
         msg.msg_iovlen = 1;
-        msg.msg_name = (struct sockaddr *)&c_source_addr;
-        msg.msg_namelen = c_socklen;
+        msg.msg_name = (struct sockaddr *)&source_addr;
 
         ESP_LOGI(RX_TASK_TAG, "CONFIG_LWIP_NETBUF_RECVINFO defined");
 #endif
  
         ESP_LOGI(RX_TASK_TAG, "Waiting for UDP data");
 
-        while (1) {
+        bool failed = false;
+        while (!failed) {
+            // block for the first datagram, then take whatever else is already pending
+            int flags = 0;
+            uint16_t batch = 0;
+
+            hci_h2c_batch_begin();
+            while (batch < RX_BATCH) {
+                // H4 packets are received straight into a free H2C queue slot
+                uint16_t rx_size;
+                uint8_t *rx_buffer = hci_h2c_rx_buffer(&rx_size);
+                source_len = sizeof(source_addr);
 #if defined(CONFIG_LWIP_NETBUF_RECVINFO) && !defined(CONFIG_EXAMPLE_IPV6)
-            int len = recvmsg(c_sock, &msg, 0);
+                iov.iov_base = rx_buffer;
+                iov.iov_len = rx_size;
+                msg.msg_namelen = source_len;
+                msg.msg_controllen = sizeof(cmsg_buf);
+                msg.msg_flags = 0;
+                int len = recvmsg(sock, &msg, flags);
+                source_len = msg.msg_namelen;
 #else
-            int len = recvfrom(c_sock, rx_buffer, RX_BUF_SIZE - 1, 0, (struct sockaddr *)&c_source_addr, &c_socklen);
+                int len = recvfrom(sock, rx_buffer, rx_size, flags, (struct sockaddr *)&source_addr, &source_len);
 #endif
-            // Error occurred during receiving
-            if (len < 0) {
-                ESP_LOGE(RX_TASK_TAG, "Error occured during recvfrom: errno %d", errno);
-                break;
-            }
-            else {
-              // Data received
-#ifdef HCI_PROTO_DEBUG
-              ESP_LOGI(RX_TASK_TAG, "Received from socket %d bytes", len);
-              ESP_LOG_BUFFER_HEXDUMP(RX_TASK_TAG, rx_buffer, len, ESP_LOG_INFO);
+                s_rx_stamp = hci_lat_now();
+                if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    // a full idle period without a datagram from the session host
+                    if (batch == 0)
+                        hci_session_close(true);
+                    break;
+                }
+                // Error occurred during receiving
+                if (len < 0) {
+                    ESP_LOGE(RX_TASK_TAG, "Error occured during recvfrom: errno %d", errno);
+                    failed = true;
+                    break;
+                }
+                flags = MSG_DONTWAIT;
+                batch++;
+                if (len == 0) {
+                    // empty datagram, nothing to parse
+                    continue;
+                }
+
+                uint8_t *data = rx_buffer;
+#ifdef CONFIG_HCI_IP_AEAD
+                uint8_t rsp[HCI_IP_AUTH_RSP_LEN];
+                int rsp_len;
+                len = open_datagram(&data, len, rsp, &rsp_len);
+                // the handshake answer goes to its sender, the session stays where it is
+                if (rsp_len > 0)
+                    sendto(sock, rsp, rsp_len, 0, (struct sockaddr *)&source_addr, source_len);
+                if (len == 0)
+                    continue;
 #endif
 
-#ifdef HCI_PROTO_TEST
-              // if we received TEST packet, reply back on the socket
-              if (rx_buffer[0] == 0x0a)
-              {
-                // TODO - handle partial write
-                sendto(c_sock, &rx_buffer[0], len, 0, (struct sockaddr *)&c_source_addr, sizeof(c_source_addr));
-                continue;
-              }
+                // The first datagram while idle decides who owns the socket.
+                // Features negotiated by a previous host do not carry over.
+                if (!hci_session_established() && hci_session_accept((struct sockaddr *)&source_addr, source_len))
+                    hci_ctrl_reset();
+#ifdef HCI_PROTO_DEBUG
+                ESP_LOGI(RX_TASK_TAG, "Received from socket %d bytes", len);
+                ESP_LOG_BUFFER_HEXDUMP(RX_TASK_TAG, data, len, ESP_LOG_INFO);
 #endif
- 
-              bool send_available= esp_vhci_host_check_send_available();
-              if (send_available)
-                esp_vhci_host_send_packet(rx_buffer, len);
-              else
-                ESP_LOGE(RX_TASK_TAG, "esp_vhci not available for sending\n");
+
+                dispatch_datagram(data, len);
             }
+            hci_h2c_batch_end(batch);
         }
 
-        if (c_sock != -1) {
+        // returns once no sender holds the descriptor, then it can be closed
+        hci_session_attach(-1);
+        if (sock != -1) {
             ESP_LOGE(RX_TASK_TAG, "Shutting down socket and restarting...");
-            shutdown(c_sock, 0);
-            close(c_sock);
+            shutdown(sock, 0);
+            close(sock);
         }
     }
-    free(rx_buffer);
     vTaskDelete(NULL);
 }
+#endif
 
-#define CONFIG_PROVISIONING_SIZE 10
+/*
+ * @brief: Associate and get an IP while app_main() brings up the controller
+ */
+static void network_connect_task(void *pvParameters)
+{
+    ESP_ERROR_CHECK(example_connect());
+    hci_boot_mark(HCI_BOOT_NETWORK);
+#ifdef CONFIG_HCI_IP_WIFI_PS
+    // not fatal, the radio then keeps the default power save mode
+    hci_ps_start();
+#endif
+    xTaskNotifyGive(s_boot_task);
+    vTaskDelete(NULL);
+}
 
-static void serial_prov_task(void *pvParameters)
+/*
+ * @brief: Register the VHCI callbacks and reset the controller once, so that
+ *         its first-command latency is paid during boot and not by the host
+ */
+static void controller_warmup(void)
 {
-  while(1)
-  {
-    int count_n = 0;
-    char c;
+    static const uint8_t hci_reset[] = { 0x01, 0x03, 0x0c, 0x00 };
 
-    while ((c = getc(stdin)) != '\n')
-    {
-      {
-        // n...n
-        if (c == 0x6E)
-          count_n++;
-      }
-    }
+    s_warmup_done = xSemaphoreCreateBinary();
+    s_warmup_pending = s_warmup_done != NULL;
 
-    if (count_n >= CONFIG_PROVISIONING_SIZE)
-    {
-      ESP_LOGI(TAG, "Going to provision WiFi now");
-      if (ESP_OK != do_console_provision(true, true))
-        ESP_LOGE(TAG, "Provision WiFi now failed");
-    } 
-  }
+    /* Register the callbacks used by controller */
+    esp_vhci_host_register_callback(&vhci_host_cb);
+    if (!s_warmup_pending)
+        return;
+
+    if (hci_h2c_enqueue(hci_reset, sizeof(hci_reset), hci_lat_now(), pdMS_TO_TICKS(WARMUP_TIMEOUT_MS)) &&
+        xSemaphoreTake(s_warmup_done, pdMS_TO_TICKS(WARMUP_TIMEOUT_MS)) == pdTRUE)
+        hci_boot_mark(HCI_BOOT_HCI_RESET);
+    else
+        ESP_LOGW(tag, "No answer to the warm-up HCI Reset");
+    s_warmup_pending = false;
 }
 
 void app_main(void)
 {
+#if !CONFIG_IDF_TARGET_LINUX
     show_reset_reason();
+#endif
 
     esp_err_t ret;
 
     ESP_ERROR_CHECK(nvs_flash_init());
     ESP_ERROR_CHECK(esp_netif_init());
     ESP_ERROR_CHECK(esp_event_loop_create_default());
+#ifdef CONFIG_HCI_IP_METRICS
+    hci_metrics_init();
+#endif
+#ifdef CONFIG_HCI_IP_SNOOP
+    ESP_ERROR_CHECK(hci_snoop_init());
+#endif
 
-    /* This helper function configures Wi-Fi or Ethernet, as selected in menuconfig.
-     * Read "Establishing Wi-Fi or Ethernet Connection" section in
-     * examples/protocols/README.md for more information about this function.
-     */
-    xTaskCreatePinnedToCore(&serial_prov_task, "serial_prov_task", 4096, NULL, 0, NULL, 0);
+#if defined(CONFIG_HCI_IP_AEAD) && CONFIG_EXAMPLE_CONNECT_WIFI
+    // the link key can follow the Wi-Fi credentials on the provisioning line
+    example_set_provision_extra(hci_aead_provision, "link key, 32 or 64 hex digits, - to erase");
+#endif
 
-    ESP_ERROR_CHECK(example_connect());
+#ifdef CONFIG_HCI_IP_PROV_TRIGGER
+    // console provisioning can be started while example_connect() still retries
+    ESP_ERROR_CHECK(hci_prov_init());
+    xTaskCreatePinnedToCore(&hci_prov_task, "prov_task", 4096, NULL, 0, NULL, 0);
+#endif
 
     ret = esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT);
     if (ret) {
@@ -321,6 +586,14 @@ void app_main(void)
         return;
     }
 
+    /* This helper function configures Wi-Fi or Ethernet, as selected in menuconfig.
+     * Read "Establishing Wi-Fi or Ethernet Connection" section in
+     * examples/protocols/README.md for more information about this function.
+     * It blocks until an IP is acquired, the controller comes up meanwhile.
+     */
+    s_boot_task = xTaskGetCurrentTaskHandle();
+    xTaskCreatePinnedToCore(&network_connect_task, "connect_task", 4096, NULL, 1, NULL, 0);
+
     esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
     ret = esp_bt_controller_init(&bt_cfg);
     if (ret != ESP_OK) {
@@ -333,8 +606,50 @@ void app_main(void)
         ESP_LOGE(tag, "Bluetooth Controller initialize failed: %s", esp_err_to_name(ret));
         return;
     }
-    
+    hci_boot_mark(HCI_BOOT_BT_ENABLED);
+
 #ifdef CONFIG_HCI_IP_IPV4
-    xTaskCreatePinnedToCore(&udp_server_task, "udp_server_task", 4096, NULL, 5, NULL, 0);
+    // logged so that benchmark results can be matched to the layout they ran on
+    ESP_LOGI(TAG, "Task layout (core/prio): rx %d/%d, h2c %d/%d, upstream %d/%d",
+             CONFIG_HCI_IP_RX_TASK_CORE, HCI_IP_RX_TASK_PRIO, CONFIG_HCI_IP_H2C_TASK_CORE, HCI_IP_H2C_TASK_PRIO,
+             CONFIG_HCI_IP_UPLINK_TASK_CORE, HCI_IP_UPLINK_TASK_PRIO);
+    ESP_ERROR_CHECK(hci_h2c_init());
+    xTaskCreatePinnedToCore(&h2c_tx_task, "h2c_tx_task", HCI_IP_H2C_TASK_STACK, NULL,
+                            HCI_IP_H2C_TASK_PRIO, &h2c_tx_handle, HCI_IP_H2C_TASK_CORE);
+#ifdef CONFIG_HCI_IP_TRANSPORT_TCP
+    ESP_ERROR_CHECK(hci_uplink_start(tcp_send_upstream, NULL));
+    controller_warmup();
+    xTaskCreatePinnedToCore(&tcp_server_task, "tcp_server_task", HCI_IP_RX_TASK_STACK, NULL,
+                            HCI_IP_RX_TASK_PRIO, NULL, HCI_IP_RX_TASK_CORE);
+#else
+#ifndef CONFIG_HCI_IP_UDP_RAW
+    ESP_ERROR_CHECK(hci_session_init());
+#endif
+#ifdef CONFIG_HCI_IP_AEAD
+    ESP_ERROR_CHECK(hci_aead_init());
 #endif
+    ESP_ERROR_CHECK(hci_uplink_start(udp_send_upstream, udp_sendv_upstream));
+#ifdef HCI_PROTO_TEST
+    ESP_ERROR_CHECK(hci_bench_init(udp_send_upstream));
+#endif
+    controller_warmup();
+#ifdef CONFIG_HCI_IP_UDP_RAW
+    xTaskCreatePinnedToCore(&udp_raw_task, "udp_raw_task", HCI_IP_RX_TASK_STACK, NULL,
+                            HCI_IP_RX_TASK_PRIO, NULL, HCI_IP_RX_TASK_CORE);
+#else
+    xTaskCreatePinnedToCore(&udp_server_task, "udp_server_task", HCI_IP_RX_TASK_STACK, NULL,
+                            HCI_IP_RX_TASK_PRIO, NULL, HCI_IP_RX_TASK_CORE);
+#endif
+#endif
+#ifdef CONFIG_HCI_IP_METRICS
+    xTaskCreatePinnedToCore(&hci_metrics_task, "metrics_task", 3072, NULL, 2, NULL, 0);
+#endif
+#ifdef CONFIG_HCI_IP_SNOOP
+    xTaskCreatePinnedToCore(&hci_snoop_task, "snoop_task", 3072, NULL, 2, NULL, 0);
+#endif
+#endif
+
+    // join with network_connect_task()
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    hci_boot_mark(HCI_BOOT_READY);
 }
@@ -0,0 +1,53 @@
+/* HCI-IP per-stage latency histograms
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "hci_lat.h"
+
+static hci_lat_hist_t s_hist[HCI_LAT_STAGE_NUM][HCI_LAT_TYPES];
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void hci_lat_record(hci_lat_stage_t stage, uint8_t h4_type, uint32_t start_us, uint32_t end_us)
+{
+    if (h4_type == 0 || h4_type > HCI_LAT_TYPES)
+        return;
+
+    // unsigned difference survives the 32 bit wrap of the stamps
+    uint32_t us = end_us - start_us;
+    int bucket = us ? 31 - __builtin_clz(us) : 0;
+    if (bucket >= HCI_LAT_BUCKETS)
+        bucket = HCI_LAT_BUCKETS - 1;
+
+    hci_lat_hist_t *hist = &s_hist[stage][h4_type - 1];
+    portENTER_CRITICAL(&s_lock);
+    hist->count++;
+    hist->sum_us += us;
+    if (us > hist->max_us)
+        hist->max_us = us;
+    hist->buckets[bucket]++;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+bool hci_lat_get(hci_lat_stage_t stage, uint8_t h4_type, hci_lat_hist_t *hist)
+{
+    if (stage >= HCI_LAT_STAGE_NUM || h4_type == 0 || h4_type > HCI_LAT_TYPES)
+        return false;
+
+    portENTER_CRITICAL(&s_lock);
+    *hist = s_hist[stage][h4_type - 1];
+    portEXIT_CRITICAL(&s_lock);
+    return true;
+}
+
+void hci_lat_reset(void)
+{
+    portENTER_CRITICAL(&s_lock);
+    memset(s_hist, 0, sizeof(s_hist));
+    portEXIT_CRITICAL(&s_lock);
+}
@@ -0,0 +1,86 @@
+/* HCI-IP per-stage latency histograms
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+#include "esp_timer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Packets are stamped with the low 32 bits of esp_timer_get_time() when
+ * they enter the proxy and at each hand-over. Every completed stage adds
+ * one sample to a histogram per stage and H4 packet type. Bucket i counts
+ * samples in [2^i, 2^(i+1)) microseconds, bucket 0 also counts 0 and the
+ * last bucket everything above.
+ */
+
+#define HCI_LAT_BUCKETS     20
+#define HCI_LAT_TYPES       5       /* H4 types 0x01..0x05 */
+
+typedef enum {
+    HCI_LAT_H2C_QUEUE = 0,  /* H2C queue entry -> esp_vhci_host_send_packet() done */
+    HCI_LAT_H2C_TOTAL,      /* socket receive -> esp_vhci_host_send_packet() done */
+    HCI_LAT_C2H_RING,       /* host_rcv_pkt() entry -> upstream task picks the packet */
+    HCI_LAT_C2H_SEND,       /* upstream task picks the packet -> send done */
+    HCI_LAT_C2H_TOTAL,      /* host_rcv_pkt() entry -> send done */
+    HCI_LAT_STAGE_NUM,
+} hci_lat_stage_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t sum_us;
+    uint32_t buckets[HCI_LAT_BUCKETS];
+} hci_lat_hist_t;
+
+#ifdef CONFIG_HCI_IP_LATENCY
+
+static inline uint32_t hci_lat_now(void)
+{
+    return (uint32_t)esp_timer_get_time();
+}
+
+/*
+ * @brief: Add one sample, safe to call from any task
+ */
+void hci_lat_record(hci_lat_stage_t stage, uint8_t h4_type, uint32_t start_us, uint32_t end_us);
+
+/*
+ * @brief: Copy one histogram
+ * return: false if stage or type is out of range
+ */
+bool hci_lat_get(hci_lat_stage_t stage, uint8_t h4_type, hci_lat_hist_t *hist);
+
+/*
+ * @brief: Clear all histograms
+ */
+void hci_lat_reset(void);
+
+#else
+
+static inline uint32_t hci_lat_now(void)
+{
+    return 0;
+}
+
+static inline void hci_lat_record(hci_lat_stage_t stage, uint8_t h4_type, uint32_t start_us, uint32_t end_us)
+{
+}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
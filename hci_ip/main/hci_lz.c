@@ -0,0 +1,172 @@
+/* HCI-IP upstream compression
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+#include <stdlib.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "hci_proto.h"
+#include "hci_lz.h"
+
+/* largest datagram the upstream task builds, a full bundle plus one packet */
+#define LZ_MAX_IN           (CONFIG_HCI_IP_BUNDLE_MTU + HCI_IP_BUNDLE_REC_HDR + HCI_IP_MAX_PKT_SIZE)
+#define LZ_HASH_BITS        9
+#define LZ_HASH_SIZE        (1 << LZ_HASH_BITS)
+#define LZ_NONE             0xffff
+
+/*
+ * Shared dictionary, the host primes its window with the same bytes.
+ * Changing it breaks existing hosts, a new dictionary needs a new feature bit.
+ */
+static const uint8_t s_dict[] = {
+    // AD structures: Microsoft CDP, Samsung, Apple Find My, Nearby and iBeacon
+    0x1e, 0xff, 0x06, 0x00, 0x01, 0x09, 0x20, 0x02,
+    0xff, 0x75, 0x00, 0x42, 0x04, 0x01,
+    0x1e, 0xff, 0x4c, 0x00, 0x12, 0x19,
+    0x07, 0xff, 0x4c, 0x00, 0x12, 0x02, 0x00,
+    0x0b, 0xff, 0x4c, 0x00, 0x10, 0x06,
+    0x1a, 0xff, 0x4c, 0x00, 0x02, 0x15,
+    // Google Fast Pair, exposure notification and Eddystone service data
+    0x03, 0x03, 0x2c, 0xfe, 0x06, 0x16, 0x2c, 0xfe,
+    0x03, 0x03, 0x6f, 0xfd, 0x17, 0x16, 0x6f, 0xfd,
+    0x03, 0x03, 0xaa, 0xfe, 0x11, 0x16, 0xaa, 0xfe, 0x10, 0x00,
+    // TX power, names, flags
+    0x02, 0x0a, 0x00, 0x02, 0x0a, 0x08, 0x09, 0x08, 0x09, 0x09,
+    0x02, 0x01, 0x1a, 0x02, 0x01, 0x18, 0x02, 0x01, 0x02, 0x02, 0x01, 0x06,
+    // LE Advertising Report, one report: ADV_NONCONN_IND, SCAN_RSP, ADV_IND
+    0x04, 0x3e, 0x2b, 0x02, 0x01, 0x03, 0x01,
+    0x04, 0x3e, 0x2b, 0x02, 0x01, 0x04, 0x01,
+    0x04, 0x3e, 0x2b, 0x02, 0x01, 0x00, 0x00,
+    0x04, 0x3e, 0x2b, 0x02, 0x01, 0x00, 0x01,
+    // LE Extended Advertising Report, one legacy report, 1M PHY, no periodic, not directed
+    0x04, 0x3e, 0x37, 0x0d, 0x01, 0x10, 0x00, 0x01,
+    0x04, 0x3e, 0x37, 0x0d, 0x01, 0x1b, 0x00, 0x01,
+    0x04, 0x3e, 0x37, 0x0d, 0x01, 0x13, 0x00, 0x00,
+    0x04, 0x3e, 0x37, 0x0d, 0x01, 0x13, 0x00, 0x01,
+    0x01, 0x00, 0xff, 0x7f, 0xc0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+#define LZ_DICT_LEN         ((int)sizeof(s_dict))
+
+static const char *TAG = "HCI_LZ";
+
+static uint8_t *s_window;               // dictionary followed by the datagram
+static uint8_t *s_out;
+static uint16_t s_dict_hash[LZ_HASH_SIZE];
+static uint16_t s_hash[LZ_HASH_SIZE];   // last window position per hash of 3 bytes
+static hci_lz_stats_t s_stats;
+
+static inline uint16_t hash3(const uint8_t *p)
+{
+    return ((p[0] | p[1] << 8 | p[2] << 16) * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+esp_err_t hci_lz_init(void)
+{
+    s_window = malloc(LZ_DICT_LEN + LZ_MAX_IN);
+    s_out = malloc(LZ_MAX_IN);
+    if (!s_window || !s_out) {
+        ESP_LOGE(TAG, "Unable to allocate the compression window");
+        return ESP_ERR_NO_MEM;
+    }
+
+    memcpy(s_window, s_dict, LZ_DICT_LEN);
+    memset(s_dict_hash, 0xff, sizeof(s_dict_hash));
+    for (int i = 0; i + 2 < LZ_DICT_LEN; i++)
+        s_dict_hash[hash3(&s_dict[i])] = i;
+    return ESP_OK;
+}
+
+/*
+ * @brief: Greedy LZ77 of the datagram at s_window[LZ_DICT_LEN], into s_out
+ * return: compressed length, 0 if not smaller than len
+ */
+static uint16_t compress(uint16_t len)
+{
+    const uint8_t *win = s_window;
+    uint32_t end = LZ_DICT_LEN + len;
+    uint32_t pos = LZ_DICT_LEN;
+    uint16_t op = 0;
+    uint16_t flag_pos = 0;
+    uint8_t items = 8;
+
+    memcpy(s_hash, s_dict_hash, sizeof(s_hash));
+    s_out[op++] = HCI_IP_PKT_LZ;
+    s_out[op++] = len & 0xff;
+    s_out[op++] = len >> 8;
+
+    while (pos < end) {
+        // worst case for the next item: a new flag byte and a match
+        if (op + 3 > len)
+            return 0;
+        if (items == 8) {
+            flag_pos = op++;
+            s_out[flag_pos] = 0;
+            items = 0;
+        }
+
+        uint32_t match_len = 0;
+        uint32_t dist = 0;
+        if (end - pos >= HCI_IP_LZ_MIN_MATCH) {
+            uint16_t h = hash3(&win[pos]);
+            uint16_t cand = s_hash[h];
+            s_hash[h] = pos;
+            if (cand != LZ_NONE && pos - cand <= HCI_IP_LZ_MAX_DIST) {
+                uint32_t max = end - pos < HCI_IP_LZ_MAX_MATCH ? end - pos : HCI_IP_LZ_MAX_MATCH;
+                // may run into the bytes being matched, the decoder copies byte by byte
+                while (match_len < max && win[cand + match_len] == win[pos + match_len])
+                    match_len++;
+                dist = pos - cand;
+            }
+        }
+
+        if (match_len >= HCI_IP_LZ_MIN_MATCH) {
+            uint16_t token = (dist - 1) | (match_len - HCI_IP_LZ_MIN_MATCH) << 12;
+            s_out[op++] = token & 0xff;
+            s_out[op++] = token >> 8;
+            s_out[flag_pos] |= 1 << items;
+            // later matches may start inside this one
+            for (uint32_t i = 1; i < match_len && pos + i + HCI_IP_LZ_MIN_MATCH <= end; i++)
+                s_hash[hash3(&win[pos + i])] = pos + i;
+            pos += match_len;
+        } else {
+            s_out[op++] = win[pos++];
+        }
+        items++;
+    }
+
+    return op < len ? op : 0;
+}
+
+uint16_t hci_lz_compress(const struct iovec *iov, int iovcnt, uint16_t len, const uint8_t **out)
+{
+    if (len > LZ_MAX_IN)
+        return 0;
+
+    int64_t start = esp_timer_get_time();
+    uint16_t pos = LZ_DICT_LEN;
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(&s_window[pos], iov[i].iov_base, iov[i].iov_len);
+        pos += iov[i].iov_len;
+    }
+    uint16_t out_len = compress(len);
+
+    s_stats.cpu_us += esp_timer_get_time() - start;
+    s_stats.datagrams++;
+    s_stats.in_bytes += len;
+    s_stats.out_bytes += out_len ? out_len : len;
+    if (out_len)
+        s_stats.compressed++;
+
+    *out = s_out;
+    return out_len;
+}
+
+void hci_lz_get_stats(hci_lz_stats_t *stats)
+{
+    *stats = s_stats;
+}
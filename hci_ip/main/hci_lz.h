@@ -0,0 +1,55 @@
+/* HCI-IP upstream compression
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "lwip/sockets.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * LZ77 over a window that starts with a fixed dictionary of common
+ * advertising report bytes, see HCI_IP_PKT_LZ in hci_proto.h for the format.
+ * Every datagram is compressed on its own so a lost one does not stall the
+ * others. Memory is allocated once; only used by the upstream task.
+ */
+
+typedef struct {
+    uint32_t datagrams;     /* datagrams run through the compressor */
+    uint32_t compressed;    /* sent compressed, the others did not get smaller */
+    uint32_t in_bytes;      /* datagram bytes run through the compressor */
+    uint32_t out_bytes;     /* bytes sent for them, compressed or not */
+    uint32_t cpu_us;        /* time spent compressing */
+} hci_lz_stats_t;
+
+/*
+ * @brief: Allocate the window and hash the dictionary
+ */
+esp_err_t hci_lz_init(void);
+
+/*
+ * @brief: Compress one datagram given as iovecs of len bytes in total
+ * params: out: set to the HCI_IP_PKT_LZ datagram, valid until the next call
+ * return: compressed length, 0 if the datagram did not get smaller and is
+ *         sent as is
+ */
+uint16_t hci_lz_compress(const struct iovec *iov, int iovcnt, uint16_t len, const uint8_t **out);
+
+/*
+ * @brief: Snapshot of the compression counters
+ */
+void hci_lz_get_stats(hci_lz_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
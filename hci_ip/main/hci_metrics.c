@@ -0,0 +1,233 @@
+/* HCI-IP metrics endpoint
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+#include <stdatomic.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_event.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_wifi.h"
+#include "esp_eth.h"
+#endif
+#include "lwip/sockets.h"
+#include "hci_proto.h"
+#include "hci_h2c.h"
+#include "hci_h4.h"
+#include "hci_rel.h"
+#include "hci_adv_cache.h"
+#include "hci_lz.h"
+#include "hci_aead.h"
+#include "hci_session.h"
+#include "hci_udp_raw.h"
+#include "hci_boot.h"
+#include "hci_ps.h"
+#include "hci_metrics.h"
+
+#define METRICS_PORT        CONFIG_HCI_IP_METRICS_PORT
+
+static const char *TAG = "HCI_METRICS";
+
+// written by the default event loop task
+static atomic_uint s_disconnects;
+static atomic_uint s_ip_acquired;
+
+#if !CONFIG_IDF_TARGET_LINUX
+static void link_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    if ((event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) ||
+        (event_base == ETH_EVENT && event_id == ETHERNET_EVENT_DISCONNECTED))
+        atomic_fetch_add(&s_disconnects, 1);
+    else if (event_base == IP_EVENT && (event_id == IP_EVENT_STA_GOT_IP || event_id == IP_EVENT_ETH_GOT_IP))
+        atomic_fetch_add(&s_ip_acquired, 1);
+}
+#endif
+
+static uint32_t h4_errors(hci_h4_dir_t dir)
+{
+    hci_h4_stats_t st;
+
+    hci_h4_get_stats(dir, &st);
+    return st.bad_type + st.too_long + st.truncated + st.trailing;
+}
+
+void hci_metrics_snapshot(hci_metrics_snapshot_t *snap)
+{
+    memset(snap, 0, sizeof(*snap));
+    snap->version = HCI_METRICS_VERSION;
+    snap->length = sizeof(*snap);
+    snap->uptime_ms = esp_timer_get_time() / 1000;
+
+    hci_h2c_stats_t h2c;
+    hci_h2c_get_stats(&h2c);
+    memcpy(snap->h2c_pkts, h2c.pkts, sizeof(snap->h2c_pkts));
+    memcpy(snap->h2c_bytes, h2c.bytes, sizeof(snap->h2c_bytes));
+    snap->h2c_busy = h2c.dropped;
+    snap->h2c_oversize = h2c.oversize;
+    snap->h2c_depth = h2c.depth;
+    snap->h2c_high_water = h2c.high_water;
+    snap->h2c_zero_copy = h2c.zero_copy;
+    snap->h2c_copied_bytes = h2c.copied_bytes;
+    memcpy(snap->rx_batch, h2c.batch, sizeof(snap->rx_batch));
+
+    hci_uplink_tx_stats_t tx;
+    hci_uplink_get_tx_stats(&tx);
+    memcpy(snap->c2h_pkts, tx.pkts, sizeof(snap->c2h_pkts));
+    memcpy(snap->c2h_bytes, tx.bytes, sizeof(snap->c2h_bytes));
+    snap->c2h_send_errors = tx.send_errors;
+    snap->c2h_last_errno = tx.last_errno;
+    snap->c2h_copied_bytes = tx.copied_bytes;
+
+    for (int i = 0; i < HCI_UPLINK_PRIO_NUM; i++) {
+        hci_ring_stats_t ring;
+        hci_uplink_get_stats(i, &ring);
+        snap->c2h_overflow[i] = ring.overflows;
+        snap->c2h_depth[i] = ring.depth;
+        snap->c2h_high_water[i] = ring.high_water;
+    }
+
+    snap->h2c_malformed = h4_errors(HCI_H4_DIR_H2C);
+    snap->c2h_malformed = h4_errors(HCI_H4_DIR_C2H);
+
+#ifdef CONFIG_HCI_IP_ADV_CACHE
+    hci_adv_cache_stats_t adv;
+    hci_adv_cache_get_stats(&adv);
+    snap->adv_suppressed = adv.hits;
+#endif
+
+#ifdef CONFIG_HCI_IP_RELIABLE
+    hci_rel_stats_t rel;
+    hci_rel_get_stats(&rel);
+    snap->rel_retransmits = rel.retransmits;
+    snap->rel_abandoned = rel.abandoned;
+#endif
+
+    snap->heap_free = esp_get_free_heap_size();
+    snap->heap_min_free = esp_get_minimum_free_heap_size();
+
+#if !CONFIG_IDF_TARGET_LINUX
+    wifi_ap_record_t ap;
+    if (esp_wifi_sta_get_ap_info(&ap) == ESP_OK)
+        snap->rssi = ap.rssi;
+#endif
+    snap->wifi_disconnects = atomic_load(&s_disconnects);
+    // the first IP is the initial connect
+    unsigned int acquired = atomic_load(&s_ip_acquired);
+    snap->wifi_reconnects = acquired ? acquired - 1 : 0;
+
+#ifdef CONFIG_HCI_IP_TRANSPORT_UDP
+    hci_session_stats_t session;
+    hci_session_get_stats(&session);
+    snap->sessions = session.established;
+    snap->session_peer_changes = session.peer_changes;
+    snap->session_expired = session.expired;
+#endif
+
+#ifdef CONFIG_HCI_IP_UDP_RAW
+    hci_udp_raw_stats_t raw;
+    hci_udp_raw_get_stats(&raw);
+    snap->udp_rx_copied = raw.copied;
+    snap->udp_rx_queue_full = raw.queue_full;
+#endif
+
+    snap->boot_ready_ms = hci_boot_ms(HCI_BOOT_READY);
+    snap->boot_first_host_pkt_ms = hci_boot_ms(HCI_BOOT_FIRST_HOST_PKT);
+
+#ifdef CONFIG_HCI_IP_COMPRESS
+    hci_lz_stats_t lz;
+    hci_lz_get_stats(&lz);
+    snap->lz_datagrams = lz.datagrams;
+    snap->lz_compressed = lz.compressed;
+    snap->lz_in_bytes = lz.in_bytes;
+    snap->lz_out_bytes = lz.out_bytes;
+    snap->lz_cpu_us = lz.cpu_us;
+#endif
+
+#ifdef CONFIG_HCI_IP_AEAD
+    hci_aead_stats_t aead;
+    hci_aead_get_stats(&aead);
+    snap->aead_handshakes = aead.handshakes;
+    snap->aead_sealed = aead.sealed;
+    snap->aead_opened = aead.opened;
+    snap->aead_no_session = aead.no_session;
+    snap->aead_auth_failed = aead.auth_failed;
+    snap->aead_replayed = aead.replayed;
+    snap->aead_seal_us = aead.seal_us;
+    snap->aead_open_us = aead.open_us;
+#endif
+
+#ifdef CONFIG_HCI_IP_WIFI_PS
+    hci_ps_stats_t ps;
+    hci_ps_get_stats(&ps);
+    snap->ps_sleeping = ps.sleeping;
+    snap->hci_connections = ps.connections;
+    snap->ps_enter = ps.enter;
+    snap->ps_exit = ps.exit;
+    snap->ps_sleep_ms = ps.sleep_ms;
+    snap->ps_pkts_in_sleep = ps.pkts_in_sleep;
+    snap->ps_wake_us_max = ps.wake_us_max;
+    snap->ps_set_errors = ps.set_errors;
+#endif
+}
+
+void hci_metrics_init(void)
+{
+#if !CONFIG_IDF_TARGET_LINUX
+    esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &link_event_handler, NULL);
+    esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &link_event_handler, NULL);
+    esp_event_handler_register(ETH_EVENT, ETHERNET_EVENT_DISCONNECTED, &link_event_handler, NULL);
+    esp_event_handler_register(IP_EVENT, IP_EVENT_ETH_GOT_IP, &link_event_handler, NULL);
+#endif
+}
+
+void hci_metrics_task(void *pvParameters)
+{
+    struct sockaddr_in dest_addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(METRICS_PORT),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if (sock < 0) {
+        ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+        vTaskDelete(NULL);
+        return;
+    }
+
+    if (bind(sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) < 0) {
+        ESP_LOGE(TAG, "Socket unable to bind: errno %d", errno);
+        close(sock);
+        vTaskDelete(NULL);
+        return;
+    }
+    ESP_LOGI(TAG, "Metrics socket bound, port %d", METRICS_PORT);
+
+    while (1) {
+        uint8_t req[16];
+        struct sockaddr_storage source_addr;
+        socklen_t addr_len = sizeof(source_addr);
+
+        int len = recvfrom(sock, req, sizeof(req), 0, (struct sockaddr *)&source_addr, &addr_len);
+        if (len < 0) {
+            ESP_LOGE(TAG, "Error occurred during recvfrom: errno %d", errno);
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+        if (len < 1 || req[0] != HCI_METRICS_REQ_GET)
+            continue;
+
+        hci_metrics_snapshot_t snap;
+        hci_metrics_snapshot(&snap);
+        if (sendto(sock, &snap, sizeof(snap), 0, (struct sockaddr *)&source_addr, addr_len) < 0)
+            ESP_LOGW(TAG, "Error occurred during sendto: errno %d", errno);
+    }
+}
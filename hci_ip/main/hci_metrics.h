@@ -0,0 +1,135 @@
+/* HCI-IP metrics endpoint
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "hci_h2c.h"
+#include "hci_uplink.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A datagram starting with HCI_METRICS_REQ_GET sent to
+ * CONFIG_HCI_IP_METRICS_PORT is answered with one hci_metrics_snapshot_t.
+ * Fields are little endian and only ever appended; a poller checks version
+ * and length and ignores what it does not know. Counters wrap at 2^32.
+ */
+
+#define HCI_METRICS_VERSION     1
+#define HCI_METRICS_REQ_GET     0x01
+
+typedef struct __attribute__((packed)) {
+    uint8_t version;                /* HCI_METRICS_VERSION */
+    uint8_t reserved;
+    uint16_t length;                /* size of the snapshot in bytes */
+    uint32_t uptime_ms;
+
+    /* traffic, indexed by H4 type */
+    uint32_t h2c_pkts[6];           /* handed to the controller */
+    uint32_t h2c_bytes[6];
+    uint32_t c2h_pkts[6];           /* handed to the upstream transport */
+    uint32_t c2h_bytes[6];
+
+    /* drops by reason */
+    uint32_t h2c_busy;              /* H2C queue stayed full, controller busy */
+    uint32_t h2c_oversize;          /* larger than an H2C queue slot */
+    uint32_t h2c_malformed;         /* rejected by the H4 parser */
+    uint32_t c2h_malformed;         /* rejected by the H4 parser */
+    uint32_t c2h_overflow[HCI_UPLINK_PRIO_NUM];     /* C2H ring full, per class */
+    uint32_t c2h_send_errors;       /* failed socket writes */
+    int32_t c2h_last_errno;         /* errno of the last failed socket write */
+    uint32_t adv_suppressed;        /* advertising reports filtered, HCI_IP_ADV_CACHE */
+    uint32_t rel_retransmits;       /* HCI_IP_RELIABLE */
+    uint32_t rel_abandoned;         /* HCI_IP_RELIABLE */
+
+    /* queues, packets */
+    uint16_t h2c_depth;
+    uint16_t h2c_high_water;
+    uint16_t c2h_depth[HCI_UPLINK_PRIO_NUM];
+    uint16_t c2h_high_water[HCI_UPLINK_PRIO_NUM];
+
+    /* system */
+    uint32_t heap_free;
+    uint32_t heap_min_free;         /* low-water mark since boot */
+    int8_t rssi;                    /* dBm, 0 when not associated or on Ethernet */
+    uint8_t reserved2[3];
+    uint32_t wifi_disconnects;      /* Wi-Fi or Ethernet link lost, since the proxy started */
+    uint32_t wifi_reconnects;       /* IP acquired again after the first connect */
+
+    /* UDP session, see hci_session.h */
+    uint32_t sessions;              /* sessions established */
+    uint32_t session_peer_changes;  /* sessions taken over by a different host */
+    uint32_t session_expired;       /* sessions released by the idle timeout */
+
+    /* raw lwIP UDP backend, HCI_IP_UDP_RAW */
+    uint32_t udp_rx_copied;         /* datagrams spread over a pbuf chain */
+    uint32_t udp_rx_queue_full;     /* dropped, the receive task fell behind */
+
+    /* boot timeline, ms since esp_timer start, 0 if not reached, see hci_boot.h */
+    uint32_t boot_ready_ms;         /* controller and network both up */
+    uint32_t boot_first_host_pkt_ms;
+
+    /* adaptive Wi-Fi power save, HCI_IP_WIFI_PS, see hci_ps.h */
+    uint8_t ps_sleeping;            /* 1 while in modem sleep */
+    uint8_t hci_connections;        /* links the controller reported open */
+    uint8_t reserved3[2];
+    uint32_t ps_enter;              /* quiet periods that went to modem sleep */
+    uint32_t ps_exit;               /* woken up by a packet */
+    uint32_t ps_sleep_ms;           /* total time in modem sleep */
+    uint32_t ps_pkts_in_sleep;      /* packets seen while in modem sleep */
+    uint32_t ps_wake_us_max;        /* first packet in modem sleep -> power save off */
+    uint32_t ps_set_errors;         /* esp_wifi_set_ps() failures */
+
+    /* payload copies made by the proxy itself, not by lwIP or the controller */
+    uint32_t h2c_zero_copy;         /* host packets handed over in their receive slot */
+    uint32_t h2c_copied_bytes;      /* host packets moved into an H2C slot */
+    uint32_t c2h_copied_bytes;      /* reliable frames, bundles gathered without sendv */
+
+    /* UDP receive wakeups by datagrams read, 1, 2-3, 4-7, 8-15, 16-31, 32, HCI_IP_RX_BATCH */
+    uint32_t rx_batch[HCI_H2C_BATCH_BUCKETS];
+
+    /* upstream compression, HCI_IP_COMPRESS, see hci_lz.h */
+    uint32_t lz_datagrams;          /* datagrams run through the compressor */
+    uint32_t lz_compressed;         /* sent compressed */
+    uint32_t lz_in_bytes;           /* in / out is the compression ratio */
+    uint32_t lz_out_bytes;
+    uint32_t lz_cpu_us;             /* time spent compressing, per KB: lz_cpu_us * 1024 / lz_in_bytes */
+
+    /* link encryption, HCI_IP_AEAD, see hci_aead.h */
+    uint32_t aead_handshakes;       /* session keys confirmed by the host */
+    uint32_t aead_sealed;           /* datagrams encrypted */
+    uint32_t aead_opened;           /* datagrams decrypted and authenticated */
+    uint32_t aead_no_session;       /* dropped before a handshake */
+    uint32_t aead_auth_failed;      /* dropped, bad tag or framing */
+    uint32_t aead_replayed;         /* dropped, seq seen before or too old */
+    uint32_t aead_seal_us;          /* per datagram: aead_seal_us / aead_sealed */
+    uint32_t aead_open_us;          /* per datagram: aead_open_us / aead_opened */
+} hci_metrics_snapshot_t;
+
+/*
+ * @brief: Start counting link events, before the network is brought up
+ */
+void hci_metrics_init(void);
+
+/*
+ * @brief: Fill a snapshot of all proxy counters
+ */
+void hci_metrics_snapshot(hci_metrics_snapshot_t *snap);
+
+/*
+ * @brief: Answer metrics requests on CONFIG_HCI_IP_METRICS_PORT
+ */
+void hci_metrics_task(void *pvParameters);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,189 @@
+/* HCI-IP wire protocol
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "sdkconfig.h"
+
+//#define HCI_PROTO_DEBUG 1
+#define HCI_PROTO_TEST 1
+
+/*
+ * By default every datagram carries exactly one H4 packet, first byte is the
+ * H4 packet type. Types that are not H4 are used by the proxy itself:
+ *
+ *   0x0a  test/benchmark: [0x0a][op][payload], see HCI_IP_BENCH_*; any other
+ *                  op is echoed back unchanged (HCI_PROTO_TEST)
+ *   0x0b  control: [0x0b][op][payload], used to negotiate optional features
+ *   0x0c  bundle:  [0x0c]{[len lo][len hi][H4 packet]}..., only sent upstream
+ *                  once the host enabled HCI_IP_FEAT_BUNDLE
+ *   0x0d  reliable data: [0x0d][seq lo][seq hi][datagram], any of the above
+ *                  wrapped with a per-direction sequence number
+ *   0x0e  reliable ack: [0x0e][next seq lo][next seq hi][u32 LE sack bitmap],
+ *                  bit i of the bitmap acknowledges sequence next + 1 + i
+ *   0x0f  compressed: [0x0f][len lo][len hi][LZ77 stream], decodes to a
+ *                  len byte datagram, a single H4 packet or a bundle. Only
+ *                  sent upstream once the host enabled HCI_IP_FEAT_COMPRESS,
+ *                  and wrapped in 0x0d when reliable delivery is on
+ *   0x10  sealed:  [0x10][u64 LE seq][ciphertext][16 byte tag], any of the
+ *                  above encrypted with the session key, see HCI_IP_AEAD_*
+ *   0x11  auth:    [0x11][op][payload], session key handshake, never sealed
+ *
+ * A host that never sends a control packet keeps the legacy framing.
+ */
+
+/*
+ * Largest HCI payloads used by the ESP32 controller: ACL data up to 1021
+ * bytes (BR/EDR buffer size reported by HCI_Read_Buffer_Size), command,
+ * event and SCO payloads up to 255 bytes.
+ */
+#define HCI_IP_MAX_ACL_DATA_LEN     1021
+#define HCI_IP_MAX_CMD_PARAM_LEN    255
+#define HCI_IP_MAX_EVT_PARAM_LEN    255
+#define HCI_IP_MAX_SCO_DATA_LEN     255
+
+/* largest H4 packet carried in either direction: type + ACL header + data */
+#define HCI_IP_MAX_PKT_SIZE         (1 + 4 + HCI_IP_MAX_ACL_DATA_LEN)
+
+/* H4 packet types */
+#define H4_TYPE_COMMAND             0x01
+#define H4_TYPE_ACL                 0x02
+#define H4_TYPE_SCO                 0x03
+#define H4_TYPE_EVENT               0x04
+#define H4_TYPE_ISO                 0x05
+
+/* proxy packet types */
+#define HCI_IP_PKT_TEST             0x0a
+#define HCI_IP_PKT_CTRL             0x0b
+#define HCI_IP_PKT_BUNDLE           0x0c
+#define HCI_IP_PKT_REL_DATA         0x0d
+#define HCI_IP_PKT_REL_ACK          0x0e
+#define HCI_IP_PKT_LZ               0x0f
+#define HCI_IP_PKT_SEALED           0x10
+#define HCI_IP_PKT_AUTH             0x11
+
+/*
+ * Control ops
+ *
+ * HELLO:     host -> target, [u32 LE requested features]
+ * HELLO_RSP: target -> host, [u32 LE granted features][u16 LE bundle MTU]
+ * LAT_GET:   host -> target, [stage][H4 type], see hci_lat.h
+ * LAT_RSP:   target -> host, [stage][H4 type][u32 count][u32 max us]
+ *                            [u64 sum us][u32 bucket] x HCI_LAT_BUCKETS, all LE
+ * LAT_RESET: host -> target, no payload and no response, clears all histograms
+ * BYE:       host -> target, no payload and no response, ends the UDP session
+ *            and drops back to legacy framing, see hci_session.h
+ */
+#define HCI_IP_CTRL_HELLO           0x01
+#define HCI_IP_CTRL_HELLO_RSP       0x02
+#define HCI_IP_CTRL_LAT_GET         0x03
+#define HCI_IP_CTRL_LAT_RSP         0x04
+#define HCI_IP_CTRL_LAT_RESET       0x05
+#define HCI_IP_CTRL_BYE             0x06
+
+/* largest control response */
+#define HCI_IP_CTRL_RSP_MAX         128
+
+/*
+ * Benchmark ops, all fields LE, target stamps are esp_timer microseconds
+ * truncated to 32 bits. Answers use op | HCI_IP_BENCH_RSP.
+ *
+ * ECHO:   [u32 seq][u32 host stamp][u32 target stamp][padding], sent back
+ *         with the target stamp filled in at reception
+ * STREAM: [u16 datagram size][u32 count][u32 interval us], the target sends
+ *         count datagrams [u32 seq][u32 target stamp][padding] of the given
+ *         size, count 0 stops a running stream
+ * SINK:   [u32 seq][padding], counted and dropped by the target
+ * RESET:  clear the sink and stream counters, answered with REPORT
+ * REPORT: answered with [u32 sink pkts][u32 sink bytes][u32 sink lost]
+ *         [u32 sink reordered][u32 sink first..last us][u32 stream sent]
+ *         [u32 stream errors][u32 stream retries][u32 stream first..last us]
+ */
+#define HCI_IP_BENCH_ECHO           0x01
+#define HCI_IP_BENCH_STREAM         0x02
+#define HCI_IP_BENCH_SINK           0x03
+#define HCI_IP_BENCH_RESET          0x04
+#define HCI_IP_BENCH_REPORT         0x05
+#define HCI_IP_BENCH_RSP            0x80
+
+/* feature bits */
+#define HCI_IP_FEAT_BUNDLE          (1u << 0)
+#define HCI_IP_FEAT_RELIABLE        (1u << 1)
+#define HCI_IP_FEAT_COMPRESS        (1u << 2)
+
+#ifdef CONFIG_HCI_IP_RELIABLE
+#define HCI_IP_FEAT_REL_SUPPORTED   HCI_IP_FEAT_RELIABLE
+#else
+#define HCI_IP_FEAT_REL_SUPPORTED   0
+#endif
+#ifdef CONFIG_HCI_IP_COMPRESS
+#define HCI_IP_FEAT_LZ_SUPPORTED    HCI_IP_FEAT_COMPRESS
+#else
+#define HCI_IP_FEAT_LZ_SUPPORTED    0
+#endif
+#define HCI_IP_FEAT_SUPPORTED       (HCI_IP_FEAT_BUNDLE | HCI_IP_FEAT_REL_SUPPORTED | HCI_IP_FEAT_LZ_SUPPORTED)
+
+/* bundle record header: 16 bit little endian length of the H4 packet */
+#define HCI_IP_BUNDLE_REC_HDR       2
+
+/* reliable data header and ack frame sizes */
+#define HCI_IP_REL_DATA_HDR         3
+#define HCI_IP_REL_ACK_LEN          7
+
+/*
+ * Compressed stream: a flag byte, then up to 8 items, repeated. Bit i of the
+ * flag byte, LSB first, tells whether item i is a literal byte (0) or a
+ * match (1). A match is a u16 LE: bits 0-11 are distance - 1, bits 12-15
+ * are length - HCI_IP_LZ_MIN_MATCH. It copies length bytes, one at a time,
+ * from distance bytes back. The decoder window starts with the dictionary
+ * in hci_lz.c, so distances may reach back into it. Each datagram starts
+ * from the bare dictionary.
+ */
+#define HCI_IP_LZ_HDR               3
+#define HCI_IP_LZ_MIN_MATCH         3
+#define HCI_IP_LZ_MAX_MATCH         18
+#define HCI_IP_LZ_MAX_DIST          4096
+
+/*
+ * Link encryption, used when a pre-shared key is provisioned on the target.
+ * Every datagram in both directions is then sealed, except the handshake.
+ *
+ * AUTH_INIT: host -> target, [16 byte host nonce Nh][16 byte tag], Nh fresh
+ *            for every handshake, tag = first 16 bytes of
+ *            HMAC-SHA256(PSK, "HCI-IP AUTH" Nh)
+ * AUTH_RSP:  target -> host, [16 byte target nonce Nt][16 byte tag]
+ *
+ * Session key = first PSK-length bytes of HMAC-SHA256(PSK, "HCI-IP AEAD" Nh Nt).
+ * Datagrams are AES-GCM (or AES-CCM, HCI_IP_AEAD_CCM) with a 16 byte tag:
+ * IV = [direction][0][0][0][u64 LE seq], direction 0 from the host and 1
+ * from the target, AAD = [0x10][u64 LE seq]. Both directions count seq from
+ * 1 under each new session key. The AUTH_RSP tag seals an empty message with
+ * seq 0, direction 1 and AAD = [0x11][0x02][Nh][Nt], so the host knows the
+ * target holds the PSK. The target keeps the previous session key until a
+ * datagram sealed with the new one arrives, which proves the host derived
+ * it, and only then moves the session to that host. The host should send
+ * right after AUTH_RSP, a BYE or HELLO will do. The target drops a datagram
+ * whose seq it has already seen or which is more than
+ * HCI_IP_AEAD_REPLAY_WINDOW behind the newest one.
+ */
+#define HCI_IP_AUTH_INIT            0x01
+#define HCI_IP_AUTH_RSP             0x02
+#define HCI_IP_AUTH_NONCE_LEN       16
+#define HCI_IP_AUTH_INIT_LEN        (2 + HCI_IP_AUTH_NONCE_LEN + HCI_IP_AEAD_TAG_LEN)
+#define HCI_IP_AUTH_RSP_LEN         (2 + HCI_IP_AUTH_NONCE_LEN + HCI_IP_AEAD_TAG_LEN)
+#define HCI_IP_AEAD_HDR             9
+#define HCI_IP_AEAD_TAG_LEN         16
+#define HCI_IP_AEAD_OVERHEAD        (HCI_IP_AEAD_HDR + HCI_IP_AEAD_TAG_LEN)
+#define HCI_IP_AEAD_REPLAY_WINDOW   64
+
+/* largest datagram received from the host: a reliable frame, sealed */
+#define HCI_IP_MAX_DGRAM_SIZE       (HCI_IP_MAX_PKT_SIZE + HCI_IP_REL_DATA_HDR + HCI_IP_AEAD_OVERHEAD)
+/* UDP payload of a 1500 byte IPv4 packet, larger datagrams are fragmented */
+#define HCI_IP_UDP_PAYLOAD_MAX      1472
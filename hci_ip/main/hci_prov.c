@@ -0,0 +1,108 @@
+/* HCI-IP serial provisioning trigger
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "driver/uart.h"
+#include "driver/uart_vfs.h"
+#include "hci_prov.h"
+
+#define CONSOLE_UART        CONFIG_ESP_CONSOLE_UART_NUM
+#define RX_BUF_SIZE         256
+#define EVENT_QUEUE_LEN     8
+#define PATTERN_CHAR        CONFIG_HCI_IP_PROV_PATTERN_CHAR
+#define PATTERN_LEN         CONFIG_HCI_IP_PROV_PATTERN_LEN
+// longest gap between pattern characters the detector allows, in baud cycles
+#define PATTERN_CHR_TOUT    0xffff
+#define PATTERN_QUEUE_LEN   4
+
+static const char *TAG = "HCI_PROV";
+
+static QueueHandle_t s_events;
+
+extern esp_err_t do_console_provision(bool, bool);
+
+static void arm_pattern(void)
+{
+    // no idle time is required around the pattern, it may be typed by hand
+    uart_enable_pattern_det_baud_intr(CONSOLE_UART, PATTERN_CHAR, PATTERN_LEN, PATTERN_CHR_TOUT, 0, 0);
+    uart_pattern_queue_reset(CONSOLE_UART, PATTERN_QUEUE_LEN);
+}
+
+esp_err_t hci_prov_init(void)
+{
+    // same console setup as example_configure_stdin_stdout(), which skips it
+    // once the driver is installed, plus the event queue
+    setvbuf(stdin, NULL, _IONBF, 0);
+    esp_err_t err = uart_driver_install(CONSOLE_UART, RX_BUF_SIZE, 0, EVENT_QUEUE_LEN, &s_events, 0);
+    if (err != ESP_OK)
+        return err;
+    uart_vfs_dev_use_driver(CONSOLE_UART);
+    uart_vfs_dev_port_set_rx_line_endings(CONSOLE_UART, ESP_LINE_ENDINGS_CR);
+    uart_vfs_dev_port_set_tx_line_endings(CONSOLE_UART, ESP_LINE_ENDINGS_CRLF);
+
+    arm_pattern();
+    return ESP_OK;
+}
+
+/*
+ * @brief: Console input stays in the driver buffer for whoever reads stdin,
+ *         this task only wakes up on driver events
+ */
+void hci_prov_task(void *pvParameters)
+{
+    uart_event_t event;
+
+    while (1) {
+        if (xQueueReceive(s_events, &event, portMAX_DELAY) != pdTRUE)
+            continue;
+
+        switch (event.type)
+        {
+          case UART_PATTERN_DET: {
+            int pos = uart_pattern_pop_pos(CONSOLE_UART);
+            if (pos < 0) {
+                // the position queue overflowed, drop everything typed so far
+                uart_flush_input(CONSOLE_UART);
+            } else {
+                // remove the pattern and whatever came before it
+                uint8_t discard[16];
+                int left = pos + PATTERN_LEN;
+                while (left > 0) {
+                    int n = uart_read_bytes(CONSOLE_UART, discard, MIN(left, (int)sizeof(discard)), 0);
+                    if (n <= 0)
+                        break;
+                    left -= n;
+                }
+            }
+
+            ESP_LOGI(TAG, "Going to provision WiFi now");
+            uart_disable_pattern_det_intr(CONSOLE_UART);
+            // restarts the chip on success
+            if (ESP_OK != do_console_provision(true, true))
+                ESP_LOGE(TAG, "Provision WiFi now failed");
+            uart_flush_input(CONSOLE_UART);
+            xQueueReset(s_events);
+            arm_pattern();
+            break;
+          }
+          case UART_BUFFER_FULL:
+          case UART_FIFO_OVF:
+            // nobody reads the console, make room for the next pattern
+            uart_flush_input(CONSOLE_UART);
+            xQueueReset(s_events);
+            break;
+          default:
+            break;
+        }
+    }
+}
@@ -0,0 +1,38 @@
+/* HCI-IP serial provisioning trigger
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#pragma once
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The console UART watches for CONFIG_HCI_IP_PROV_PATTERN_LEN repetitions of
+ * CONFIG_HCI_IP_PROV_PATTERN_CHAR with its hardware pattern detector. The
+ * trigger task sleeps on the driver event queue and only starts Wi-Fi
+ * provisioning on the console once the pattern was seen.
+ */
+
+/*
+ * @brief: Install the console UART driver with an event queue and route
+ *         stdin/stdout through it, must run before example_connect()
+ */
+esp_err_t hci_prov_init(void);
+
+/*
+ * @brief: Wait for the trigger pattern and run console provisioning
+ */
+void hci_prov_task(void *pvParameters);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,229 @@
+/* HCI-IP adaptive Wi-Fi power save
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdatomic.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "hci_proto.h"
+#include "hci_ps.h"
+
+#define IDLE_MS             CONFIG_HCI_IP_WIFI_PS_IDLE_MS
+#ifdef CONFIG_HCI_IP_WIFI_PS_SLEEP_MAX_MODEM
+#define SLEEP_MODE          WIFI_PS_MAX_MODEM
+#else
+#define SLEEP_MODE          WIFI_PS_MIN_MODEM
+#endif
+
+#define EV_CONN_COMPLETE        0x03
+#define EV_DISCONN_COMPLETE     0x05
+#define EV_SYNC_CONN_COMPLETE   0x2c
+#define EV_LE_META              0x3e
+#define LE_CONN_COMPLETE        0x01
+#define LE_ENH_CONN_COMPLETE    0x0a
+#define LE_ENH_CONN_COMPLETE_V2 0x29
+#define OP_RESET                0x0c03
+
+static const char *TAG = "HCI_PS";
+
+static TaskHandle_t s_task;
+
+// written from the packet paths, read by ps_task()
+static atomic_uint s_last_ms;           // last packet in either direction
+static atomic_int s_conns;
+static atomic_bool s_sleeping;
+static atomic_uint s_wake_us;           // first packet while sleeping, 0 if none yet
+static atomic_uint s_pkts_in_sleep;
+
+// ps_task() only, copied out under the lock
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static hci_ps_stats_t s_stats;
+static int64_t s_sleep_since_us;        // 0 while awake
+
+static inline uint32_t now_ms(void)
+{
+    return esp_timer_get_time() / 1000;
+}
+
+static void activity(void)
+{
+    atomic_store_explicit(&s_last_ms, now_ms(), memory_order_relaxed);
+    if (!atomic_load(&s_sleeping))
+        return;
+
+    atomic_fetch_add(&s_pkts_in_sleep, 1);
+    // only the first packet of a sleep period wakes the task, 0 is reserved for none
+    unsigned int expected = 0;
+    if (atomic_compare_exchange_strong(&s_wake_us, &expected, (uint32_t)esp_timer_get_time() | 1))
+        xTaskNotifyGive(s_task);
+}
+
+static void conn_opened(uint8_t status)
+{
+    if (status == 0)
+        atomic_fetch_add(&s_conns, 1);
+}
+
+static void conn_closed(uint8_t status)
+{
+    // links opened before the proxy started counting are not known
+    if (status == 0 && atomic_fetch_sub(&s_conns, 1) <= 0)
+        atomic_store(&s_conns, 0);
+}
+
+void hci_ps_h2c(const hci_h4_pkt_t *pkt)
+{
+    // a reset drops every link without Disconnection Complete events
+    if (pkt->type == H4_TYPE_COMMAND && (pkt->hdr[0] | pkt->hdr[1] << 8) == OP_RESET)
+        atomic_store(&s_conns, 0);
+    activity();
+}
+
+void hci_ps_c2h(const hci_h4_pkt_t *pkt)
+{
+    const uint8_t *p = pkt->payload;
+
+    if (pkt->type == H4_TYPE_EVENT && pkt->payload_len >= 2) {
+        switch (pkt->hdr[0])
+        {
+          case EV_CONN_COMPLETE:
+          case EV_SYNC_CONN_COMPLETE:
+            conn_opened(p[0]);
+            break;
+          case EV_DISCONN_COMPLETE:
+            conn_closed(p[0]);
+            break;
+          case EV_LE_META:
+            if (p[0] == LE_CONN_COMPLETE || p[0] == LE_ENH_CONN_COMPLETE || p[0] == LE_ENH_CONN_COMPLETE_V2)
+                conn_opened(p[1]);
+            break;
+          default:
+            break;
+        }
+    }
+    activity();
+}
+
+void hci_ps_touch(void)
+{
+    activity();
+}
+
+static void enter_sleep(void)
+{
+    // packets from here on see the flag and wake the task, even during the switch
+    atomic_store(&s_wake_us, 0);
+    atomic_store(&s_sleeping, true);
+
+    esp_err_t err = esp_wifi_set_ps(SLEEP_MODE);
+    portENTER_CRITICAL(&s_lock);
+    if (err == ESP_OK) {
+        s_stats.enter++;
+        s_sleep_since_us = esp_timer_get_time();
+    } else {
+        s_stats.set_errors++;
+    }
+    portEXIT_CRITICAL(&s_lock);
+
+    if (err != ESP_OK) {
+        atomic_store(&s_sleeping, false);
+        ESP_LOGW(TAG, "Unable to enter modem sleep: %s", esp_err_to_name(err));
+        return;
+    }
+    ESP_LOGD(TAG, "Quiet for %d ms, modem sleep", IDLE_MS);
+}
+
+static void leave_sleep(uint32_t wake_stamp)
+{
+    esp_err_t err = esp_wifi_set_ps(WIFI_PS_NONE);
+    int64_t now = esp_timer_get_time();
+    uint32_t wake_us = (uint32_t)now - wake_stamp;
+
+    atomic_store(&s_sleeping, false);
+    portENTER_CRITICAL(&s_lock);
+    if (err == ESP_OK) {
+        s_stats.exit++;
+        s_stats.sleep_ms += (now - s_sleep_since_us) / 1000;
+        s_sleep_since_us = 0;
+        s_stats.wake_us_last = wake_us;
+        if (wake_us > s_stats.wake_us_max)
+            s_stats.wake_us_max = wake_us;
+    } else {
+        s_stats.set_errors++;
+    }
+    portEXIT_CRITICAL(&s_lock);
+
+    if (err != ESP_OK)
+        ESP_LOGW(TAG, "Unable to leave modem sleep: %s", esp_err_to_name(err));
+    else
+        ESP_LOGD(TAG, "Traffic, power save off after %lu us", (unsigned long)wake_us);
+}
+
+/*
+ * @brief: Waits for the quiet period while awake and for the first packet
+ *         while in modem sleep, all esp_wifi calls are made here
+ */
+static void ps_task(void *pvParameters)
+{
+    while (1) {
+        TickType_t wait = portMAX_DELAY;
+
+        if (!atomic_load(&s_sleeping)) {
+            uint32_t quiet = now_ms() - atomic_load_explicit(&s_last_ms, memory_order_relaxed);
+            if (atomic_load(&s_conns) > 0) {
+                // the Disconnection Complete event counts as traffic, check again later
+                wait = pdMS_TO_TICKS(IDLE_MS);
+            } else if (quiet >= IDLE_MS) {
+                enter_sleep();
+                continue;
+            } else {
+                wait = pdMS_TO_TICKS(IDLE_MS - quiet);
+            }
+        }
+
+        ulTaskNotifyTake(pdTRUE, wait);
+
+        if (atomic_load(&s_sleeping)) {
+            uint32_t stamp = atomic_exchange(&s_wake_us, 0);
+            if (stamp)
+                leave_sleep(stamp);
+        }
+    }
+}
+
+esp_err_t hci_ps_start(void)
+{
+    esp_err_t err = esp_wifi_set_ps(WIFI_PS_NONE);
+    if (err != ESP_OK) {
+        s_stats.set_errors++;
+        ESP_LOGW(TAG, "Unable to turn power save off, policy disabled: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    atomic_store(&s_last_ms, now_ms());
+    if (xTaskCreatePinnedToCore(&ps_task, "ps_task", 2048, NULL, 3, &s_task, 0) != pdPASS)
+        return ESP_ERR_NO_MEM;
+    ESP_LOGI(TAG, "Power save off, modem sleep after %d ms without HCI traffic", IDLE_MS);
+    return ESP_OK;
+}
+
+void hci_ps_get_stats(hci_ps_stats_t *stats)
+{
+    portENTER_CRITICAL(&s_lock);
+    *stats = s_stats;
+    if (s_sleep_since_us)
+        stats->sleep_ms += (esp_timer_get_time() - s_sleep_since_us) / 1000;
+    portEXIT_CRITICAL(&s_lock);
+
+    stats->sleeping = atomic_load(&s_sleeping);
+    stats->pkts_in_sleep = atomic_load(&s_pkts_in_sleep);
+    int conns = atomic_load(&s_conns);
+    stats->connections = conns > 255 ? 255 : conns;
+}
@@ -0,0 +1,87 @@
+/* HCI-IP adaptive Wi-Fi power save
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "hci_h4.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Wi-Fi power save stays off (WIFI_PS_NONE) while HCI packets flow in
+ * either direction or the controller reports open connections. After
+ * CONFIG_HCI_IP_WIFI_PS_IDLE_MS without a packet and without connections the
+ * station goes to modem sleep, the next packet turns power save off again.
+ * While in modem sleep the AP holds host packets until the next DTIM beacon,
+ * the counters below show how often that happened and what switching back
+ * cost.
+ */
+
+typedef struct {
+    bool sleeping;          /* modem sleep applied right now */
+    uint8_t connections;    /* ACL, SCO and LE links the controller reported open */
+    uint32_t enter;         /* quiet periods that went to modem sleep */
+    uint32_t exit;          /* woken up by a packet */
+    uint32_t sleep_ms;      /* total time in modem sleep, current period included */
+    uint32_t pkts_in_sleep; /* packets seen while in modem sleep */
+    uint32_t wake_us_last;  /* first packet in modem sleep -> power save off */
+    uint32_t wake_us_max;
+    uint32_t set_errors;    /* esp_wifi_set_ps() failures */
+} hci_ps_stats_t;
+
+#ifdef CONFIG_HCI_IP_WIFI_PS
+
+/*
+ * @brief: Turn power save off and start the policy task, Wi-Fi must be started
+ */
+esp_err_t hci_ps_start(void);
+
+/*
+ * @brief: Note a valid host to controller packet, receive tasks only
+ */
+void hci_ps_h2c(const hci_h4_pkt_t *pkt);
+
+/*
+ * @brief: Note a valid controller to host packet, safe in controller context
+ */
+void hci_ps_c2h(const hci_h4_pkt_t *pkt);
+
+/*
+ * @brief: Note proxy traffic that is not an HCI packet, e.g. a benchmark
+ *         datagram, safe in task context
+ */
+void hci_ps_touch(void);
+
+void hci_ps_get_stats(hci_ps_stats_t *stats);
+
+#else
+
+static inline void hci_ps_h2c(const hci_h4_pkt_t *pkt)
+{
+}
+
+static inline void hci_ps_c2h(const hci_h4_pkt_t *pkt)
+{
+}
+
+static inline void hci_ps_touch(void)
+{
+}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,296 @@
+/* HCI-IP reliability layer over UDP
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+#include <errno.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "hci_proto.h"
+#include "hci_rel.h"
+
+#define TX_WIN              CONFIG_HCI_IP_REL_TX_WINDOW
+#define RX_WIN              CONFIG_HCI_IP_REL_RX_WINDOW
+#define RTO_US              (CONFIG_HCI_IP_REL_RTO_MS * 1000)
+#define MAX_RETRIES         CONFIG_HCI_IP_REL_MAX_RETRIES
+
+#define TX_PAYLOAD_SIZE     MAX(CONFIG_HCI_IP_BUNDLE_MTU, 1 + HCI_IP_BUNDLE_REC_HDR + HCI_IP_MAX_PKT_SIZE)
+#define RX_PAYLOAD_SIZE     HCI_IP_MAX_PKT_SIZE
+
+// slots are indexed by sequence modulo window, which only survives the 16 bit wrap for powers of two
+_Static_assert((TX_WIN & (TX_WIN - 1)) == 0, "HCI_IP_REL_TX_WINDOW must be a power of two");
+_Static_assert((RX_WIN & (RX_WIN - 1)) == 0, "HCI_IP_REL_RX_WINDOW must be a power of two");
+
+typedef struct {
+    uint16_t len;
+    bool acked;
+    bool fast_done;
+    uint8_t retries;
+    int64_t sent_us;
+    uint8_t frame[HCI_IP_REL_DATA_HDR + TX_PAYLOAD_SIZE];
+} rel_tx_slot_t;
+
+typedef struct {
+    uint16_t len;
+    bool valid;
+    uint8_t data[RX_PAYLOAD_SIZE];
+} rel_rx_slot_t;
+
+static const char *TAG = "HCI_REL";
+
+static hci_rel_send_fn s_send;
+static void (*s_kick)(void);
+
+// upstream window, shared by the upstream task (send, poll) and the receive task (acks)
+static SemaphoreHandle_t s_tx_lock;
+static rel_tx_slot_t *s_tx;
+static uint16_t s_tx_base;      // oldest unacknowledged sequence
+static uint16_t s_tx_next;      // next sequence to assign
+static uint16_t s_sack_high;    // one past the highest selectively acked sequence
+
+// downstream reorder window, receive task only
+static rel_rx_slot_t *s_rx;
+static uint16_t s_rx_next;      // next sequence to deliver
+
+static hci_rel_stats_t s_stats;
+
+static inline int16_t seq_diff(uint16_t a, uint16_t b)
+{
+    return (int16_t)(a - b);
+}
+
+esp_err_t hci_rel_init(hci_rel_send_fn send, void (*kick)(void))
+{
+    s_send = send;
+    s_kick = kick;
+    s_tx_lock = xSemaphoreCreateMutex();
+    s_tx = calloc(TX_WIN, sizeof(rel_tx_slot_t));
+    s_rx = calloc(RX_WIN, sizeof(rel_rx_slot_t));
+    if (!s_tx_lock || !s_tx || !s_rx) {
+        ESP_LOGE(TAG, "Unable to allocate retransmit pool");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void hci_rel_reset(void)
+{
+    xSemaphoreTake(s_tx_lock, portMAX_DELAY);
+    s_tx_base = 0;
+    s_tx_next = 0;
+    s_sack_high = 0;
+    s_rx_next = 0;
+    for (int i = 0; i < RX_WIN; i++)
+        s_rx[i].valid = false;
+    xSemaphoreGive(s_tx_lock);
+    ESP_LOGI(TAG, "Reliable session reset");
+}
+
+/* must be called with s_tx_lock held */
+static void advance_base(void)
+{
+    while (s_tx_base != s_tx_next && s_tx[s_tx_base % TX_WIN].acked)
+        s_tx_base++;
+    if (seq_diff(s_sack_high, s_tx_base) < 0)
+        s_sack_high = s_tx_base;
+}
+
+void hci_rel_send(const struct iovec *iov, int iovcnt)
+{
+    size_t len = 0;
+
+    for (int i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+    if (len > TX_PAYLOAD_SIZE) {
+        ESP_LOGE(TAG, "Upstream datagram of %d bytes too large", (int)len);
+        return;
+    }
+
+    xSemaphoreTake(s_tx_lock, portMAX_DELAY);
+    if ((uint16_t)(s_tx_next - s_tx_base) >= TX_WIN)
+        s_stats.window_stalls++;
+    while ((uint16_t)(s_tx_next - s_tx_base) >= TX_WIN) {
+        xSemaphoreGive(s_tx_lock);
+        // acks from the receive task wake us up through s_kick
+        ulTaskNotifyTake(pdTRUE, hci_rel_poll());
+        xSemaphoreTake(s_tx_lock, portMAX_DELAY);
+    }
+
+    uint16_t seq = s_tx_next++;
+    rel_tx_slot_t *slot = &s_tx[seq % TX_WIN];
+    slot->frame[0] = HCI_IP_PKT_REL_DATA;
+    slot->frame[1] = seq & 0xff;
+    slot->frame[2] = seq >> 8;
+    uint16_t pos = HCI_IP_REL_DATA_HDR;
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(&slot->frame[pos], iov[i].iov_base, iov[i].iov_len);
+        pos += iov[i].iov_len;
+    }
+    slot->len = pos;
+    slot->acked = false;
+    slot->fast_done = false;
+    slot->retries = 0;
+    slot->sent_us = esp_timer_get_time();
+    xSemaphoreGive(s_tx_lock);
+
+    // only this task reuses the slot, so it is safe to send without the lock
+    s_stats.tx_frames++;
+    if (s_send(slot->frame, slot->len) < 0)
+        ESP_LOGE(TAG, "Error occurred during send: errno %d", errno);
+}
+
+TickType_t hci_rel_poll(void)
+{
+    int64_t now = esp_timer_get_time();
+
+    xSemaphoreTake(s_tx_lock, portMAX_DELAY);
+    for (uint16_t seq = s_tx_base; seq != s_tx_next; seq++) {
+        rel_tx_slot_t *slot = &s_tx[seq % TX_WIN];
+        if (slot->acked)
+            continue;
+
+        // a later frame was selectively acked, this one is most likely lost
+        bool gap = !slot->fast_done && seq_diff(seq, s_sack_high) < 0;
+        if (!gap && now - slot->sent_us < RTO_US)
+            continue;
+
+        if (slot->retries >= MAX_RETRIES) {
+            slot->acked = true;
+            s_stats.abandoned++;
+            continue;
+        }
+
+        if (gap)
+            slot->fast_done = true;
+        slot->retries++;
+        slot->sent_us = now;
+        s_stats.retransmits++;
+        s_send(slot->frame, slot->len);
+    }
+    advance_base();
+    bool in_flight = s_tx_base != s_tx_next;
+    xSemaphoreGive(s_tx_lock);
+
+    return in_flight ? MAX(1, pdMS_TO_TICKS(CONFIG_HCI_IP_REL_RTO_MS)) : portMAX_DELAY;
+}
+
+static void handle_ack(const uint8_t *frame, int len)
+{
+    if (len < HCI_IP_REL_ACK_LEN)
+        return;
+
+    uint16_t cum = frame[1] | (frame[2] << 8);
+    uint32_t sack = frame[3] | (frame[4] << 8) | (frame[5] << 16) | ((uint32_t)frame[6] << 24);
+
+    xSemaphoreTake(s_tx_lock, portMAX_DELAY);
+    s_stats.acks_rx++;
+
+    // ignore acks for sequences that were never sent
+    if (seq_diff(cum, s_tx_next) > 0) {
+        xSemaphoreGive(s_tx_lock);
+        return;
+    }
+
+    for (uint16_t seq = s_tx_base; seq_diff(seq, cum) < 0; seq++)
+        s_tx[seq % TX_WIN].acked = true;
+
+    for (int i = 0; i < 32 && sack; i++, sack >>= 1) {
+        uint16_t seq = cum + 1 + i;
+        if (!(sack & 1) || seq_diff(seq, s_tx_base) < 0 || seq_diff(seq, s_tx_next) >= 0)
+            continue;
+        s_tx[seq % TX_WIN].acked = true;
+        if (seq_diff(seq + 1, s_sack_high) > 0)
+            s_sack_high = seq + 1;
+    }
+
+    advance_base();
+    xSemaphoreGive(s_tx_lock);
+
+    if (s_kick)
+        s_kick();
+}
+
+static void send_ack(void)
+{
+    uint8_t ack[HCI_IP_REL_ACK_LEN];
+    uint32_t sack = 0;
+
+    for (int i = 0; i < RX_WIN - 1 && i < 32; i++) {
+        if (s_rx[(uint16_t)(s_rx_next + 1 + i) % RX_WIN].valid)
+            sack |= 1u << i;
+    }
+
+    ack[0] = HCI_IP_PKT_REL_ACK;
+    ack[1] = s_rx_next & 0xff;
+    ack[2] = s_rx_next >> 8;
+    ack[3] = sack;
+    ack[4] = sack >> 8;
+    ack[5] = sack >> 16;
+    ack[6] = sack >> 24;
+    s_stats.acks_tx++;
+    s_send(ack, sizeof(ack));
+}
+
+static void handle_data(uint8_t *frame, int len, hci_rel_deliver_fn deliver)
+{
+    if (len <= HCI_IP_REL_DATA_HDR || len - HCI_IP_REL_DATA_HDR > RX_PAYLOAD_SIZE)
+        return;
+
+    uint16_t seq = frame[1] | (frame[2] << 8);
+    int16_t ahead = seq_diff(seq, s_rx_next);
+    uint8_t *payload = &frame[HCI_IP_REL_DATA_HDR];
+    int payload_len = len - HCI_IP_REL_DATA_HDR;
+
+    if (ahead < 0) {
+        // already delivered, the host missed our ack
+        s_stats.duplicates++;
+    } else if (ahead >= RX_WIN) {
+        s_stats.out_of_window++;
+    } else if (ahead > 0) {
+        rel_rx_slot_t *slot = &s_rx[seq % RX_WIN];
+        if (slot->valid) {
+            s_stats.duplicates++;
+        } else {
+            memcpy(slot->data, payload, payload_len);
+            slot->len = payload_len;
+            slot->valid = true;
+            s_stats.reordered++;
+        }
+    } else {
+        deliver(payload, payload_len);
+        s_stats.rx_frames++;
+        s_rx_next++;
+
+        // release frames that were waiting for this one
+        rel_rx_slot_t *slot;
+        while ((slot = &s_rx[s_rx_next % RX_WIN])->valid) {
+            slot->valid = false;
+            deliver(slot->data, slot->len);
+            s_stats.rx_frames++;
+            s_rx_next++;
+        }
+    }
+
+    send_ack();
+}
+
+void hci_rel_input(uint8_t *frame, int len, hci_rel_deliver_fn deliver)
+{
+    if (frame[0] == HCI_IP_PKT_REL_ACK)
+        handle_ack(frame, len);
+    else if (frame[0] == HCI_IP_PKT_REL_DATA)
+        handle_data(frame, len, deliver);
+}
+
+void hci_rel_get_stats(hci_rel_stats_t *stats)
+{
+    *stats = s_stats;
+}
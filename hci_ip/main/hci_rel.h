@@ -0,0 +1,84 @@
+/* HCI-IP reliability layer over UDP
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "lwip/sockets.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Optional sequenced delivery, enabled by the host with HCI_IP_FEAT_RELIABLE.
+ *
+ * Upstream datagrams are kept in a fixed window of preallocated slots until
+ * the host acknowledges them (cumulative ack plus a selective ack bitmap) and
+ * are retransmitted on a gap or on timeout. Downstream frames are delivered
+ * in sequence order exactly once, so a retransmitted HCI command never
+ * reaches the controller twice.
+ */
+
+typedef struct {
+    uint32_t tx_frames;         /* upstream frames sent for the first time */
+    uint32_t retransmits;       /* upstream frames sent again */
+    uint32_t abandoned;         /* upstream frames given up after max retries */
+    uint32_t window_stalls;     /* upstream task waited for a free window slot */
+    uint32_t acks_rx;           /* ack frames received from the host */
+    uint32_t rx_frames;         /* downstream frames delivered */
+    uint32_t duplicates;        /* downstream frames already delivered or buffered */
+    uint32_t reordered;         /* downstream frames buffered out of order */
+    uint32_t out_of_window;     /* downstream frames too far ahead, dropped */
+    uint32_t acks_tx;           /* ack frames sent to the host */
+} hci_rel_stats_t;
+
+typedef int (*hci_rel_send_fn)(const uint8_t *data, uint16_t len);
+typedef void (*hci_rel_deliver_fn)(uint8_t *data, int len);
+
+/*
+ * @brief: Allocate the retransmit and reorder pools
+ * params: send: transport used for frames and acks
+ * params: kick: wakes the upstream task when acks free window slots
+ */
+esp_err_t hci_rel_init(hci_rel_send_fn send, void (*kick)(void));
+
+/*
+ * @brief: Start a new session, both sequence spaces restart at 0
+ */
+void hci_rel_reset(void);
+
+/*
+ * @brief: Upstream task, send one datagram sequenced, waits while the window
+ *         is full. The buffers are gathered into a retransmit slot
+ */
+void hci_rel_send(const struct iovec *iov, int iovcnt);
+
+/*
+ * @brief: Upstream task, retransmit gaps and timed out frames
+ * return: ticks until the next retransmit check, portMAX_DELAY if nothing is in flight
+ */
+TickType_t hci_rel_poll(void);
+
+/*
+ * @brief: Receive task, handle an HCI_IP_PKT_REL_DATA or HCI_IP_PKT_REL_ACK frame
+ */
+void hci_rel_input(uint8_t *frame, int len, hci_rel_deliver_fn deliver);
+
+/*
+ * @brief: Snapshot of the reliability counters
+ */
+void hci_rel_get_stats(hci_rel_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,150 @@
+/* HCI-IP lock-free packet ring
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+#include "hci_ring.h"
+
+#define HCI_RING_FLAG_WRAP          0x8000
+#define HCI_RING_ALIGN(x)           (((x) + 3u) & ~3u)
+#define HCI_RING_REC_SIZE(len)      HCI_RING_ALIGN(sizeof(hci_ring_rec_t) + (len))
+
+void hci_ring_init(hci_ring_t *ring, uint8_t *buf, uint32_t size)
+{
+    ring->buf = buf;
+    ring->size = size & ~3u;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->pushed, 0);
+    atomic_init(&ring->popped, 0);
+    atomic_init(&ring->high_water, 0);
+    atomic_init(&ring->overflows, 0);
+}
+
+bool hci_ring_push(hci_ring_t *ring, const uint8_t *data, uint16_t len, uint16_t flags, uint32_t stamp)
+{
+    uint32_t need = HCI_RING_REC_SIZE(len);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    uint32_t pos;
+
+    /* head == tail means empty, so a record may never make head catch up with tail */
+    if (head >= tail) {
+        uint32_t to_end = ring->size - head;
+        if (to_end > need || (to_end == need && tail != 0)) {
+            pos = head;
+        } else if (tail > need) {
+            // only len and flags are written, they fit in the 4 bytes left at worst
+            hci_ring_rec_t *wrap = (hci_ring_rec_t *)&ring->buf[head];
+            wrap->len = 0;
+            wrap->flags = HCI_RING_FLAG_WRAP;
+            pos = 0;
+        } else {
+            goto overflow;
+        }
+    } else if (tail - head > need) {
+        pos = head;
+    } else {
+        goto overflow;
+    }
+
+    hci_ring_rec_t *rec = (hci_ring_rec_t *)&ring->buf[pos];
+    rec->len = len;
+    rec->flags = flags & ~HCI_RING_FLAG_WRAP;
+    rec->stamp = stamp;
+    memcpy(&ring->buf[pos + sizeof(hci_ring_rec_t)], data, len);
+
+    pos += need;
+    if (pos == ring->size)
+        pos = 0;
+    atomic_store_explicit(&ring->head, pos, memory_order_release);
+
+    uint32_t pushed = atomic_load_explicit(&ring->pushed, memory_order_relaxed) + 1;
+    atomic_store_explicit(&ring->pushed, pushed, memory_order_relaxed);
+    uint32_t depth = pushed - atomic_load_explicit(&ring->popped, memory_order_relaxed);
+    if (depth > atomic_load_explicit(&ring->high_water, memory_order_relaxed))
+        atomic_store_explicit(&ring->high_water, depth, memory_order_relaxed);
+    return true;
+
+overflow:
+    atomic_store_explicit(&ring->overflows,
+                          atomic_load_explicit(&ring->overflows, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    return false;
+}
+
+uint8_t *hci_ring_peek(hci_ring_t *ring, uint16_t *len, uint16_t *flags)
+{
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if (tail == head)
+        return NULL;
+
+    hci_ring_rec_t *rec = (hci_ring_rec_t *)&ring->buf[tail];
+    if (rec->flags & HCI_RING_FLAG_WRAP) {
+        tail = 0;
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+        if (tail == head)
+            return NULL;
+        rec = (hci_ring_rec_t *)&ring->buf[tail];
+    }
+
+    *len = rec->len;
+    if (flags)
+        *flags = rec->flags;
+    return (uint8_t *)rec + sizeof(hci_ring_rec_t);
+}
+
+uint8_t *hci_ring_peek_next(hci_ring_t *ring, const uint8_t *data, uint16_t *len, uint16_t *flags)
+{
+    const hci_ring_rec_t *cur = hci_ring_rec(data);
+    uint32_t pos = (const uint8_t *)cur - ring->buf + HCI_RING_REC_SIZE(cur->len);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if (pos == ring->size)
+        pos = 0;
+    if (pos == head)
+        return NULL;
+
+    // unlike hci_ring_peek() the tail stays where it is
+    hci_ring_rec_t *rec = (hci_ring_rec_t *)&ring->buf[pos];
+    if (rec->flags & HCI_RING_FLAG_WRAP) {
+        if (head == 0)
+            return NULL;
+        rec = (hci_ring_rec_t *)ring->buf;
+    }
+
+    *len = rec->len;
+    if (flags)
+        *flags = rec->flags;
+    return (uint8_t *)rec + sizeof(hci_ring_rec_t);
+}
+
+void hci_ring_pop(hci_ring_t *ring)
+{
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    hci_ring_rec_t *rec = (hci_ring_rec_t *)&ring->buf[tail];
+
+    tail += HCI_RING_REC_SIZE(rec->len);
+    if (tail == ring->size)
+        tail = 0;
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    atomic_store_explicit(&ring->popped,
+                          atomic_load_explicit(&ring->popped, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+}
+
+void hci_ring_get_stats(hci_ring_t *ring, hci_ring_stats_t *stats)
+{
+    uint32_t popped = atomic_load_explicit(&ring->popped, memory_order_relaxed);
+
+    stats->pushed = atomic_load_explicit(&ring->pushed, memory_order_relaxed);
+    stats->depth = stats->pushed - popped;
+    stats->high_water = atomic_load_explicit(&ring->high_water, memory_order_relaxed);
+    stats->overflows = atomic_load_explicit(&ring->overflows, memory_order_relaxed);
+}
@@ -0,0 +1,102 @@
+/* HCI-IP lock-free packet ring
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Single-producer/single-consumer ring of variable length packets.
+ *
+ * Packets are stored contiguously as [hci_ring_rec_t][data], 4-byte aligned,
+ * so the consumer can hand the payload to the socket layer without copying.
+ * When a record does not fit before the end of the buffer a wrap marker is
+ * written and the record starts again at offset 0.
+ *
+ * Only the producer writes head, only the consumer writes tail; the packet
+ * counters follow the same rule so no lock is needed on either side.
+ */
+
+typedef struct {
+    uint16_t len;
+    uint16_t flags;
+    uint32_t stamp;         /* opaque to the ring, e.g. enqueue time; not valid in wrap markers */
+} hci_ring_rec_t;
+
+typedef struct {
+    uint32_t depth;         /* packets currently queued */
+    uint32_t high_water;    /* max packets ever queued at once */
+    uint32_t overflows;     /* packets dropped because the ring was full */
+    uint32_t pushed;        /* packets accepted by the ring */
+} hci_ring_stats_t;
+
+typedef struct {
+    uint8_t *buf;
+    uint32_t size;
+    atomic_uint head;       /* producer write offset */
+    atomic_uint tail;       /* consumer read offset */
+    atomic_uint pushed;     /* written by producer */
+    atomic_uint popped;     /* written by consumer */
+    atomic_uint high_water; /* written by producer */
+    atomic_uint overflows;  /* written by producer */
+} hci_ring_t;
+
+/*
+ * @brief: Initialize ring over a caller provided buffer, size must be a multiple of 4
+ */
+void hci_ring_init(hci_ring_t *ring, uint8_t *buf, uint32_t size);
+
+/*
+ * @brief: Producer side, copy one packet into the ring
+ * params: flags: returned by the peek functions, bit 15 is used by the ring
+ * return: false if the ring is full, the packet is counted as overflow
+ */
+bool hci_ring_push(hci_ring_t *ring, const uint8_t *data, uint16_t len, uint16_t flags, uint32_t stamp);
+
+/*
+ * @brief: Consumer side, get the oldest packet without removing it
+ * return: pointer to the packet data or NULL if the ring is empty
+ */
+uint8_t *hci_ring_peek(hci_ring_t *ring, uint16_t *len, uint16_t *flags);
+
+/*
+ * @brief: Consumer side, get the packet after one returned by hci_ring_peek()
+ *         or by this function, without removing anything. Lets the consumer
+ *         hold several packets in place and pop them later
+ * return: pointer to the packet data or NULL if there is none yet
+ */
+uint8_t *hci_ring_peek_next(hci_ring_t *ring, const uint8_t *data, uint16_t *len, uint16_t *flags);
+
+/*
+ * @brief: Record header of a packet returned by hci_ring_peek()
+ */
+static inline const hci_ring_rec_t *hci_ring_rec(const uint8_t *data)
+{
+    return (const hci_ring_rec_t *)data - 1;
+}
+
+/*
+ * @brief: Consumer side, release the packet returned by hci_ring_peek()
+ */
+void hci_ring_pop(hci_ring_t *ring);
+
+/*
+ * @brief: Snapshot of the ring counters, safe to call from any task
+ */
+void hci_ring_get_stats(hci_ring_t *ring, hci_ring_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,200 @@
+/* HCI-IP UDP host session
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "hci_proto.h"
+#include "hci_aead.h"
+#include "hci_session.h"
+
+static const char *TAG = "HCI_SESSION";
+
+typedef struct {
+    int sock;
+    bool connected;
+    socklen_t addr_len;             /* 0 until the first host showed up */
+    struct sockaddr_storage addr;
+} session_t;
+
+// written by the UDP receive task, copied out by the senders
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static session_t s_session = { .sock = -1 };
+// held across each send, so the receive task cannot close the socket under it
+static SemaphoreHandle_t s_send_lock;
+static hci_session_stats_t s_stats;
+
+static bool same_host(const struct sockaddr *a, const struct sockaddr_storage *b)
+{
+    if (a->sa_family != b->ss_family)
+        return false;
+
+    if (a->sa_family == AF_INET) {
+        const struct sockaddr_in *a4 = (const struct sockaddr_in *)a;
+        const struct sockaddr_in *b4 = (const struct sockaddr_in *)b;
+        return a4->sin_port == b4->sin_port && a4->sin_addr.s_addr == b4->sin_addr.s_addr;
+    }
+#if CONFIG_LWIP_IPV6
+    if (a->sa_family == AF_INET6) {
+        const struct sockaddr_in6 *a6 = (const struct sockaddr_in6 *)a;
+        const struct sockaddr_in6 *b6 = (const struct sockaddr_in6 *)b;
+        return a6->sin6_port == b6->sin6_port &&
+               memcmp(&a6->sin6_addr, &b6->sin6_addr, sizeof(a6->sin6_addr)) == 0;
+    }
+#endif
+    return false;
+}
+
+esp_err_t hci_session_init(void)
+{
+    s_send_lock = xSemaphoreCreateMutex();
+    if (!s_send_lock) {
+        ESP_LOGE(TAG, "Unable to allocate the send lock");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void hci_session_attach(int sock)
+{
+    // waits for a send in flight, the old descriptor can be closed once this returns
+    xSemaphoreTake(s_send_lock, portMAX_DELAY);
+    portENTER_CRITICAL(&s_lock);
+    s_session.sock = sock;
+    s_session.connected = false;
+    portEXIT_CRITICAL(&s_lock);
+    xSemaphoreGive(s_send_lock);
+}
+
+bool hci_session_accept(const struct sockaddr *addr, socklen_t addr_len)
+{
+    if (s_session.connected || addr_len == 0 || addr_len > sizeof(s_session.addr))
+        return false;
+
+    bool changed = !s_session.addr_len || !same_host(addr, &s_session.addr);
+
+    // lwIP filters on the connected peer from here on, other hosts are dropped
+    if (connect(s_session.sock, addr, addr_len) < 0) {
+        s_stats.connect_errors++;
+        ESP_LOGE(TAG, "Unable to connect to the host: errno %d", errno);
+        return false;
+    }
+
+    portENTER_CRITICAL(&s_lock);
+    memcpy(&s_session.addr, addr, addr_len);
+    s_session.addr_len = addr_len;
+    s_session.connected = true;
+    portEXIT_CRITICAL(&s_lock);
+
+    s_stats.established++;
+    if (changed) {
+        s_stats.peer_changes++;
+        ESP_LOGI(TAG, "Session established with a new host");
+    }
+    return changed;
+}
+
+void hci_session_close(bool expired)
+{
+    if (!s_session.connected)
+        return;
+
+    // senders fall back to sendto() to the last host before the socket is released
+    portENTER_CRITICAL(&s_lock);
+    s_session.connected = false;
+    portEXIT_CRITICAL(&s_lock);
+
+    struct sockaddr unspec = { .sa_family = AF_UNSPEC };
+    connect(s_session.sock, &unspec, sizeof(unspec));
+
+    if (expired) {
+        s_stats.expired++;
+        ESP_LOGI(TAG, "Host idle, session released");
+    } else {
+        s_stats.byes++;
+        ESP_LOGI(TAG, "Host ended the session");
+    }
+}
+
+bool hci_session_established(void)
+{
+    return s_session.connected;
+}
+
+static bool snapshot(session_t *s)
+{
+    portENTER_CRITICAL(&s_lock);
+    s->sock = s_session.sock;
+    s->connected = s_session.connected;
+    s->addr_len = s_session.addr_len;
+    if (!s->connected && s->addr_len)
+        memcpy(&s->addr, &s_session.addr, s->addr_len);
+    portEXIT_CRITICAL(&s_lock);
+
+    if (s->sock < 0 || !s->addr_len) {
+        errno = ENOTCONN;
+        return false;
+    }
+    return true;
+}
+
+static int session_sendv(const struct iovec *iov, int iovcnt)
+{
+    session_t s;
+    struct msghdr msg = { .msg_iov = (struct iovec *)iov, .msg_iovlen = iovcnt };
+    int ret = -1;
+
+    xSemaphoreTake(s_send_lock, portMAX_DELAY);
+    if (snapshot(&s)) {
+        if (!s.connected) {
+            msg.msg_name = &s.addr;
+            msg.msg_namelen = s.addr_len;
+        }
+        ret = sendmsg(s.sock, &msg, 0);
+    }
+    xSemaphoreGive(s_send_lock);
+    return ret;
+}
+
+int hci_session_send(const uint8_t *data, uint16_t len)
+{
+    session_t s;
+    int ret = -1;
+
+#ifdef CONFIG_HCI_IP_AEAD
+    if (hci_aead_enabled()) {
+        struct iovec iov = { .iov_base = (void *)data, .iov_len = len };
+        return hci_aead_sendv(&iov, 1, session_sendv);
+    }
+#endif
+
+    xSemaphoreTake(s_send_lock, portMAX_DELAY);
+    if (snapshot(&s)) {
+        if (s.connected)
+            ret = send(s.sock, data, len, 0);
+        else
+            ret = sendto(s.sock, data, len, 0, (struct sockaddr *)&s.addr, s.addr_len);
+    }
+    xSemaphoreGive(s_send_lock);
+    return ret;
+}
+
+int hci_session_sendv(const struct iovec *iov, int iovcnt)
+{
+#ifdef CONFIG_HCI_IP_AEAD
+    if (hci_aead_enabled())
+        return hci_aead_sendv(iov, iovcnt, session_sendv);
+#endif
+    return session_sendv(iov, iovcnt);
+}
+
+void hci_session_get_stats(hci_session_stats_t *stats)
+{
+    *stats = s_stats;
+}
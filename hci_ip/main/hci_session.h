@@ -0,0 +1,100 @@
+/* HCI-IP UDP host session
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "lwip/sockets.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * One host owns the UDP socket at a time. While the session is idle the
+ * socket is unconnected and the first datagram from any host establishes
+ * the session: the socket is connect()ed to that host, lwIP then drops
+ * datagrams from everyone else and sends skip the route lookup.
+ *
+ * The session goes back to idle when the host sends HCI_IP_CTRL_BYE or
+ * after CONFIG_HCI_IP_SESSION_IDLE_S seconds without a datagram from it.
+ * The next datagram, from the same or another host, establishes a new
+ * session. Upstream packets produced while idle still go to the last host.
+ *
+ * With a link key (hci_aead.h) only an authentic datagram establishes a
+ * session: the handshake is answered with a plain sendto() and leaves the
+ * socket unconnected, and the first datagram that opens with the session
+ * key connects it.
+ *
+ * Only the UDP receive task changes the session. Senders on other tasks
+ * work on a consistent snapshot taken under a spinlock, and hold a mutex
+ * across the send so that the socket is not closed or reused under them.
+ *
+ * hci_session.c implements this on the BSD socket, hci_udp_raw.c on a raw
+ * lwIP pcb (HCI_IP_UDP_RAW), where attach is not used and accept is
+ * hci_udp_raw_accept().
+ */
+
+typedef struct {
+    uint32_t established;       /* sessions started */
+    uint32_t peer_changes;      /* sessions started with a different host than the last one */
+    uint32_t byes;              /* sessions ended by the host */
+    uint32_t expired;           /* sessions ended by the idle timeout */
+    uint32_t connect_errors;    /* connect() failures, the session stays idle */
+} hci_session_stats_t;
+
+/*
+ * @brief: Create the send lock, before the first sender or socket
+ */
+esp_err_t hci_session_init(void);
+
+/*
+ * @brief: Attach a freshly bound socket, -1 detaches it. Waits for a send in
+ *         flight, so a detached socket can be closed. UDP receive task only
+ */
+void hci_session_attach(int sock);
+
+/*
+ * @brief: Establish a session with the sender of a datagram received while
+ *         idle. UDP receive task only
+ * return: true if the session belongs to a different host than the last one
+ */
+bool hci_session_accept(const struct sockaddr *addr, socklen_t addr_len);
+
+/*
+ * @brief: End the current session, the socket accepts any host again.
+ *         UDP receive task only
+ * params: expired: true for the idle timeout, false for a host BYE
+ */
+void hci_session_close(bool expired);
+
+/*
+ * @brief: True while the socket is connected to a host
+ */
+bool hci_session_established(void);
+
+/*
+ * @brief: Send one datagram to the session host, any task
+ * return: bytes sent, -1 with errno set on failure
+ */
+int hci_session_send(const uint8_t *data, uint16_t len);
+
+/*
+ * @brief: Send one datagram gathered from several buffers, any task
+ * return: bytes sent, -1 with errno set on failure
+ */
+int hci_session_sendv(const struct iovec *iov, int iovcnt);
+
+void hci_session_get_stats(hci_session_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
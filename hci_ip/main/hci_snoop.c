@@ -0,0 +1,370 @@
+/* HCI-IP btsnoop capture
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <sys/time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+#include "hci_proto.h"
+#include "hci_snoop.h"
+#ifdef CONFIG_HCI_IP_AEAD
+#include "hci_aead.h"
+#endif
+
+#define SNOOP_PORT          CONFIG_HCI_IP_SNOOP_PORT
+#define RING_SIZE           CONFIG_HCI_IP_SNOOP_RING_SIZE
+#define SNAP_MAX            HCI_IP_MAX_PKT_SIZE
+
+// btsnoop file format, all fields big endian
+#define BTSNOOP_DATALINK_H4 1002
+#define BTSNOOP_FLAG_RECV   0x01
+#define BTSNOOP_FLAG_CMDEVT 0x02
+#define REC_HDR             24
+// microseconds from 0000-01-01 to 1970-01-01, the btsnoop time base
+#define BTSNOOP_EPOCH_US    0x00dcddb30f2f8000ll
+// a wall clock before 2020 has not been set
+#define WALL_CLOCK_VALID_S  1577836800
+
+#define EVT_LE_META         0x3e
+#define SUBEVT_ADV_REPORT   0x02
+#define SUBEVT_EXT_ADV_REPORT 0x0d
+
+// holds at least one record of SNAP_MAX
+#define DUMP_CHUNK          1460
+#define DUMP_SEND_TIMEOUT_S 2
+
+static const char *TAG = "HCI_SNOOP";
+
+static const uint8_t s_file_hdr[16] = {
+    'b', 't', 's', 'n', 'o', 'o', 'p', 0,
+    0, 0, 0, 1,                                         // version
+    0, 0, BTSNOOP_DATALINK_H4 >> 8, BTSNOOP_DATALINK_H4 & 0xff,
+};
+
+// read without the lock on every packet
+static atomic_uint s_on;
+static atomic_uint s_filter;
+
+// ring of btsnoop records, the timestamp field holds esp_timer time until dumped
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t *s_ring;
+static uint32_t s_head;             // oldest record
+static bool s_paused;               // a dump is reading the ring
+static uint16_t s_snap_len = CONFIG_HCI_IP_SNOOP_SNAP_LEN;
+static hci_snoop_status_t s_status;
+
+static uint8_t s_chunk[DUMP_CHUNK];
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static uint32_t get_be32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static void ring_write(uint32_t off, const uint8_t *src, uint32_t len)
+{
+    off %= RING_SIZE;
+    uint32_t first = RING_SIZE - off < len ? RING_SIZE - off : len;
+    memcpy(&s_ring[off], src, first);
+    memcpy(s_ring, &src[first], len - first);
+}
+
+static void ring_read(uint32_t off, uint8_t *dst, uint32_t len)
+{
+    off %= RING_SIZE;
+    uint32_t first = RING_SIZE - off < len ? RING_SIZE - off : len;
+    memcpy(dst, &s_ring[off], first);
+    memcpy(&dst[first], s_ring, len - first);
+}
+
+static bool is_adv_report(const uint8_t *pkt, uint16_t len)
+{
+    // [0x04][0x3e][plen][subevent]
+    return len >= 4 && pkt[0] == 0x04 && pkt[1] == EVT_LE_META &&
+           (pkt[3] == SUBEVT_ADV_REPORT || pkt[3] == SUBEVT_EXT_ADV_REPORT);
+}
+
+esp_err_t hci_snoop_init(void)
+{
+    s_ring = malloc(RING_SIZE);
+    if (!s_ring) {
+        ESP_LOGE(TAG, "Unable to allocate the capture ring");
+        return ESP_ERR_NO_MEM;
+    }
+    atomic_store(&s_filter, HCI_SNOOP_FILTER_ALL);
+#ifdef CONFIG_HCI_IP_SNOOP_AT_BOOT
+    atomic_store(&s_on, 1);
+#endif
+    return ESP_OK;
+}
+
+void hci_snoop_capture(uint8_t dir, const uint8_t *pkt, uint16_t len)
+{
+    if (!atomic_load_explicit(&s_on, memory_order_relaxed) || len == 0)
+        return;
+
+    uint8_t type = pkt[0];
+    unsigned filter = atomic_load_explicit(&s_filter, memory_order_relaxed);
+    if (type > 5 || !(filter & (1 << type)))
+        return;
+    if ((filter & HCI_SNOOP_FILTER_NO_ADV) && is_adv_report(pkt, len))
+        return;
+
+    uint8_t hdr[REC_HDR];
+    uint64_t now = esp_timer_get_time();
+    put_be32(&hdr[0], len);
+    put_be32(&hdr[16], now >> 32);
+    put_be32(&hdr[20], now);
+    put_be32(&hdr[8], (dir == HCI_SNOOP_C2H ? BTSNOOP_FLAG_RECV : 0) |
+                      (type == 0x01 || type == 0x04 ? BTSNOOP_FLAG_CMDEVT : 0));
+
+    portENTER_CRITICAL(&s_lock);
+    if (s_paused) {
+        s_status.missed++;
+        portEXIT_CRITICAL(&s_lock);
+        return;
+    }
+    uint16_t incl = len < s_snap_len ? len : s_snap_len;
+    uint32_t need = REC_HDR + incl;
+    // make room by dropping the oldest records
+    while (s_status.ring_used + need > RING_SIZE) {
+        uint8_t old[4];
+        ring_read(s_head + 4, old, sizeof(old));
+        uint32_t old_size = REC_HDR + get_be32(old);
+        s_head = (s_head + old_size) % RING_SIZE;
+        s_status.ring_used -= old_size;
+        s_status.records--;
+        s_status.overwritten++;
+    }
+    put_be32(&hdr[4], incl);
+    put_be32(&hdr[12], s_status.missed);
+    uint32_t tail = s_head + s_status.ring_used;
+    ring_write(tail, hdr, REC_HDR);
+    ring_write(tail + REC_HDR, pkt, incl);
+    s_status.ring_used += need;
+    s_status.records++;
+    s_status.captured++;
+    if (incl < len)
+        s_status.truncated++;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void hci_snoop_get_status(hci_snoop_status_t *status)
+{
+    portENTER_CRITICAL(&s_lock);
+    *status = s_status;
+    status->snap_len = s_snap_len;
+    portEXIT_CRITICAL(&s_lock);
+    status->on = atomic_load(&s_on);
+    status->filter = atomic_load(&s_filter);
+    status->ring_size = RING_SIZE;
+}
+
+static void handle_request(const uint8_t *req, int len)
+{
+    switch (req[0])
+    {
+      case HCI_SNOOP_REQ_SET: {
+        if (len < 5)
+            return;
+        uint16_t snap_len = req[3] | req[4] << 8;
+        if (snap_len) {
+            portENTER_CRITICAL(&s_lock);
+            s_snap_len = snap_len < SNAP_MAX ? snap_len : SNAP_MAX;
+            portEXIT_CRITICAL(&s_lock);
+        }
+        atomic_store(&s_filter, req[2]);
+        atomic_store(&s_on, req[1] ? 1 : 0);
+        ESP_LOGI(TAG, "Capture %s, filter 0x%02x, snap length %u", req[1] ? "on" : "off", req[2], s_snap_len);
+        return;
+      }
+      case HCI_SNOOP_REQ_CLEAR:
+        portENTER_CRITICAL(&s_lock);
+        s_head = 0;
+        s_status.ring_used = 0;
+        s_status.records = 0;
+        portEXIT_CRITICAL(&s_lock);
+        return;
+      default:
+        return;
+    }
+}
+
+/*
+ * @brief: True while a link key is provisioned. The ports take no credentials,
+ *         so they must not give away the traffic the key protects
+ */
+static bool link_sealed(void)
+{
+#ifdef CONFIG_HCI_IP_AEAD
+    return hci_aead_enabled();
+#else
+    return false;
+#endif
+}
+
+static bool send_all(int sock, const uint8_t *data, int len)
+{
+    while (len > 0) {
+        int sent = send(sock, data, len, 0);
+        if (sent < 0)
+            return false;
+        data += sent;
+        len -= sent;
+    }
+    return true;
+}
+
+/*
+ * @brief: Send the ring as a btsnoop file, capture is paused meanwhile
+ */
+static void dump(int sock)
+{
+    struct timeval tv;
+    int64_t base = BTSNOOP_EPOCH_US;
+
+    // without SNTP the capture starts at 1970-01-01 plus the uptime
+    gettimeofday(&tv, NULL);
+    if (tv.tv_sec >= WALL_CLOCK_VALID_S)
+        base += (int64_t)tv.tv_sec * 1000000 + tv.tv_usec - esp_timer_get_time();
+
+    // a capture already past the check finishes under the lock first
+    portENTER_CRITICAL(&s_lock);
+    s_paused = true;
+    uint32_t head = s_head;
+    uint32_t used = s_status.ring_used;
+    uint32_t records = s_status.records;
+    portEXIT_CRITICAL(&s_lock);
+
+    int64_t start = esp_timer_get_time();
+    bool ok = send_all(sock, s_file_hdr, sizeof(s_file_hdr));
+    uint32_t pos = 0;
+    uint32_t fill = 0;
+    while (ok && pos < used) {
+        uint8_t *rec = &s_chunk[fill];
+        ring_read(head + pos, rec, REC_HDR);
+        uint32_t size = REC_HDR + get_be32(&rec[4]);
+        if (fill + size > DUMP_CHUNK) {
+            ok = send_all(sock, s_chunk, fill);
+            fill = 0;
+            continue;
+        }
+        ring_read(head + pos + REC_HDR, &rec[REC_HDR], size - REC_HDR);
+        int64_t ts = ((int64_t)get_be32(&rec[16]) << 32 | get_be32(&rec[20])) + base;
+        put_be32(&rec[16], (uint64_t)ts >> 32);
+        put_be32(&rec[20], ts);
+        fill += size;
+        pos += size;
+    }
+    if (ok && fill)
+        ok = send_all(sock, s_chunk, fill);
+
+    portENTER_CRITICAL(&s_lock);
+    s_paused = false;
+    portEXIT_CRITICAL(&s_lock);
+
+    if (ok)
+        ESP_LOGI(TAG, "Sent %lu records, %lu bytes in %lu ms", (unsigned long)records, (unsigned long)used,
+                 (unsigned long)((esp_timer_get_time() - start) / 1000));
+    else
+        ESP_LOGW(TAG, "Dump aborted: errno %d", errno);
+}
+
+void hci_snoop_task(void *pvParameters)
+{
+    struct sockaddr_in dest_addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(SNOOP_PORT),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+
+    int udp_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    int listen_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    if (udp_sock < 0 || listen_sock < 0) {
+        ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+        goto exit;
+    }
+
+    int opt = 1;
+    setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (bind(udp_sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) < 0 ||
+        bind(listen_sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) < 0) {
+        ESP_LOGE(TAG, "Socket unable to bind: errno %d", errno);
+        goto exit;
+    }
+    if (listen(listen_sock, 1) < 0) {
+        ESP_LOGE(TAG, "Error occurred during listen: errno %d", errno);
+        goto exit;
+    }
+    if (link_sealed()) {
+        // nothing captured from here on, requests and dumps are refused
+        atomic_store(&s_on, 0);
+        ESP_LOGW(TAG, "Link key provisioned, capture is disabled");
+    }
+    ESP_LOGI(TAG, "Capture %s, dump and control on port %d", atomic_load(&s_on) ? "on" : "off", SNOOP_PORT);
+
+    while (1) {
+        fd_set rfds;
+        FD_ZERO(&rfds);
+        FD_SET(udp_sock, &rfds);
+        FD_SET(listen_sock, &rfds);
+        if (select((udp_sock > listen_sock ? udp_sock : listen_sock) + 1, &rfds, NULL, NULL, NULL) < 0) {
+            ESP_LOGE(TAG, "Error occurred during select: errno %d", errno);
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+
+        if (FD_ISSET(udp_sock, &rfds)) {
+            uint8_t req[16];
+            struct sockaddr_storage source_addr;
+            socklen_t addr_len = sizeof(source_addr);
+            int len = recvfrom(udp_sock, req, sizeof(req), 0, (struct sockaddr *)&source_addr, &addr_len);
+            if (len >= 1 && req[0] >= HCI_SNOOP_REQ_SET && req[0] <= HCI_SNOOP_REQ_CLEAR && !link_sealed()) {
+                hci_snoop_status_t status;
+                handle_request(req, len);
+                hci_snoop_get_status(&status);
+                if (sendto(udp_sock, &status, sizeof(status), 0, (struct sockaddr *)&source_addr, addr_len) < 0)
+                    ESP_LOGW(TAG, "Error occurred during sendto: errno %d", errno);
+            }
+        }
+
+        if (FD_ISSET(listen_sock, &rfds)) {
+            int sock = accept(listen_sock, NULL, NULL);
+            if (sock < 0) {
+                ESP_LOGE(TAG, "Unable to accept connection: errno %d", errno);
+                continue;
+            }
+            // a stalled reader must not keep the capture paused
+            struct timeval timeout = { .tv_sec = DUMP_SEND_TIMEOUT_S };
+            setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            if (!link_sealed())
+                dump(sock);
+            shutdown(sock, 0);
+            close(sock);
+        }
+    }
+
+exit:
+    if (udp_sock >= 0)
+        close(udp_sock);
+    if (listen_sock >= 0)
+        close(listen_sock);
+    vTaskDelete(NULL);
+}
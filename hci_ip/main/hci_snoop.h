@@ -0,0 +1,93 @@
+/* HCI-IP btsnoop capture
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Packets at the controller boundary are kept in a RAM ring as btsnoop
+ * records (datalink H4), the oldest are overwritten. A TCP connection to
+ * CONFIG_HCI_IP_SNOOP_PORT receives a btsnoop file of the ring and is closed,
+ * Wireshark opens it as is. Capture is paused while the file is sent.
+ *
+ * Datagrams to the same port number over UDP control the capture and are
+ * answered with hci_snoop_status_t:
+ * SET:    [0x01][u8 on][u8 filter][u16 LE snap length], 0 keeps the snap length
+ * STATUS: [0x02]
+ * CLEAR:  [0x03], drops all records
+ * Filter bit n (1..5) captures H4 type n, HCI_SNOOP_FILTER_NO_ADV skips LE
+ * (extended) advertising reports, which fill the ring while scanning.
+ *
+ * Neither port is authenticated. While a link key is provisioned (hci_aead.h)
+ * capture stays off, requests get no answer and a dump connection is closed
+ * without data.
+ */
+
+#define HCI_SNOOP_REQ_SET           0x01
+#define HCI_SNOOP_REQ_STATUS        0x02
+#define HCI_SNOOP_REQ_CLEAR         0x03
+
+#define HCI_SNOOP_FILTER_NO_ADV     (1 << 6)
+#define HCI_SNOOP_FILTER_ALL        0x3e
+
+#define HCI_SNOOP_H2C               0   /* btsnoop "sent" */
+#define HCI_SNOOP_C2H               1   /* btsnoop "received" */
+
+typedef struct __attribute__((packed)) {
+    uint8_t on;
+    uint8_t filter;
+    uint16_t snap_len;
+    uint32_t ring_size;     /* bytes */
+    uint32_t ring_used;     /* bytes, btsnoop record headers included */
+    uint32_t records;       /* records in the ring */
+    uint32_t captured;      /* records written since boot */
+    uint32_t truncated;     /* records cut to the snap length */
+    uint32_t overwritten;   /* oldest records dropped for new ones */
+    uint32_t missed;        /* packets not captured while a dump was sent */
+} hci_snoop_status_t;
+
+#ifdef CONFIG_HCI_IP_SNOOP
+
+/*
+ * @brief: Allocate the ring, before the controller is enabled
+ */
+esp_err_t hci_snoop_init(void);
+
+/*
+ * @brief: Record one H4 packet, safe in controller context. Does nothing
+ *         while capture is off
+ * params: dir: HCI_SNOOP_H2C or HCI_SNOOP_C2H
+ */
+void hci_snoop_capture(uint8_t dir, const uint8_t *pkt, uint16_t len);
+
+void hci_snoop_get_status(hci_snoop_status_t *status);
+
+/*
+ * @brief: Serve dumps over TCP and control datagrams over UDP
+ */
+void hci_snoop_task(void *pvParameters);
+
+#else
+
+static inline void hci_snoop_capture(uint8_t dir, const uint8_t *pkt, uint16_t len)
+{
+}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
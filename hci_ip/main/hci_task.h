@@ -0,0 +1,33 @@
+/* HCI-IP task layout
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#pragma once
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/*
+ * Core, priority and stack of the proxy stages, see "Task layout" in
+ * Kconfig.projbuild. A core of -1 leaves the task unpinned.
+ */
+
+#define HCI_IP_TASK_CORE(core)      ((core) < 0 ? tskNO_AFFINITY : (core))
+
+#define HCI_IP_RX_TASK_CORE         HCI_IP_TASK_CORE(CONFIG_HCI_IP_RX_TASK_CORE)
+#define HCI_IP_RX_TASK_PRIO         CONFIG_HCI_IP_RX_TASK_PRIO
+#define HCI_IP_RX_TASK_STACK        CONFIG_HCI_IP_RX_TASK_STACK
+
+#define HCI_IP_H2C_TASK_CORE        HCI_IP_TASK_CORE(CONFIG_HCI_IP_H2C_TASK_CORE)
+#define HCI_IP_H2C_TASK_PRIO        CONFIG_HCI_IP_H2C_TASK_PRIO
+#define HCI_IP_H2C_TASK_STACK       CONFIG_HCI_IP_H2C_TASK_STACK
+
+#define HCI_IP_UPLINK_TASK_CORE     HCI_IP_TASK_CORE(CONFIG_HCI_IP_UPLINK_TASK_CORE)
+#define HCI_IP_UPLINK_TASK_PRIO     CONFIG_HCI_IP_UPLINK_TASK_PRIO
+#define HCI_IP_UPLINK_TASK_STACK    CONFIG_HCI_IP_UPLINK_TASK_STACK
@@ -0,0 +1,180 @@
+/* HCI-IP TCP stream transport
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "lwip/sockets.h"
+#include "hci_proto.h"
+#include "hci_h4.h"
+#include "hci_lat.h"
+#include "hci_h2c.h"
+#include "hci_boot.h"
+#include "hci_ps.h"
+#include "hci_tcp.h"
+
+#define PORT                CONFIG_HCI_IP_PORT
+#define TCP_RX_BUF_SIZE     (2 * HCI_IP_MAX_PKT_SIZE)
+#define KEEPALIVE_IDLE      5
+#define KEEPALIVE_INTERVAL  5
+#define KEEPALIVE_COUNT     3
+
+static const char *TAG = "TCP_SERVER";
+
+// held across each upstream send, so the receive task cannot close the socket under it
+static SemaphoreHandle_t s_client_lock;
+static int s_client = -1;
+
+int tcp_send_upstream(const uint8_t *data, uint16_t len)
+{
+    int ret = -1;
+
+    if (!s_client_lock) {
+        errno = ENOTCONN;
+        return -1;
+    }
+    xSemaphoreTake(s_client_lock, portMAX_DELAY);
+    if (s_client < 0)
+        errno = ENOTCONN;
+    else
+        ret = send(s_client, data, len, 0);
+    xSemaphoreGive(s_client_lock);
+    return ret;
+}
+
+/*
+ * @brief: Split the byte stream into H4 packets and queue them for the controller
+ */
+static void serve_client(int sock, uint8_t *buf)
+{
+    int fill = 0;
+
+    while (1) {
+        int len = recv(sock, &buf[fill], TCP_RX_BUF_SIZE - fill, 0);
+        uint32_t rx_stamp = hci_lat_now();
+        if (len < 0) {
+            ESP_LOGE(TAG, "Error occurred during recv: errno %d", errno);
+            return;
+        } else if (len == 0) {
+            ESP_LOGI(TAG, "Connection closed by host");
+            return;
+        }
+#ifdef HCI_PROTO_DEBUG
+        ESP_LOGI(TAG, "Received from socket %d bytes", len);
+        ESP_LOG_BUFFER_HEXDUMP(TAG, &buf[fill], len, ESP_LOG_INFO);
+#endif
+        fill += len;
+
+        int pos = 0;
+        while (pos < fill) {
+            hci_h4_pkt_t pkt;
+            hci_h4_status_t status = hci_h4_parse(&buf[pos], fill - pos, &pkt);
+            if (status == HCI_H4_NEED_MORE)
+                break;
+
+            hci_h4_count(HCI_H4_DIR_H2C, status, buf[pos]);
+            if (status != HCI_H4_OK) {
+                // framing is lost, there is no way to resynchronize the stream
+                ESP_LOGE(TAG, "Malformed H4 stream (%d, type 0x%02x), dropping connection", status, buf[pos]);
+                return;
+            }
+
+            hci_boot_mark(HCI_BOOT_FIRST_HOST_PKT);
+            hci_ps_h2c(&pkt);
+            // the stream is reliable, so wait for the controller instead of dropping
+            hci_h2c_enqueue(&buf[pos], pkt.total_len, rx_stamp, portMAX_DELAY);
+            pos += pkt.total_len;
+        }
+
+        memmove(buf, &buf[pos], fill - pos);
+        fill -= pos;
+    }
+}
+
+void tcp_server_task(void *pvParameters)
+{
+    uint8_t *rx_buffer = (uint8_t *) malloc(TCP_RX_BUF_SIZE);
+    s_client_lock = xSemaphoreCreateMutex();
+    if (!rx_buffer || !s_client_lock) {
+        ESP_LOGE(TAG, "Unable to allocate the receive buffer");
+        free(rx_buffer);
+        vTaskDelete(NULL);
+        return;
+    }
+
+    struct sockaddr_in dest_addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(PORT),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+
+    int listen_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    if (listen_sock < 0) {
+        ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+        goto exit;
+    }
+
+    int opt = 1;
+    setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    if (bind(listen_sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) < 0) {
+        ESP_LOGE(TAG, "Socket unable to bind: errno %d", errno);
+        goto exit;
+    }
+
+    // a single host owns the controller, further connections wait in the backlog
+    if (listen(listen_sock, 1) < 0) {
+        ESP_LOGE(TAG, "Error occurred during listen: errno %d", errno);
+        goto exit;
+    }
+    ESP_LOGI(TAG, "Socket listening, port %d", PORT);
+    hci_boot_mark(HCI_BOOT_SOCKET);
+
+    while (1) {
+        struct sockaddr_storage source_addr;
+        socklen_t addr_len = sizeof(source_addr);
+        int sock = accept(listen_sock, (struct sockaddr *)&source_addr, &addr_len);
+        if (sock < 0) {
+            ESP_LOGE(TAG, "Unable to accept connection: errno %d", errno);
+            break;
+        }
+
+        int nodelay = 1;
+        int keepalive = 1;
+        int keepidle = KEEPALIVE_IDLE;
+        int keepintvl = KEEPALIVE_INTERVAL;
+        int keepcnt = KEEPALIVE_COUNT;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+        setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &keepalive, sizeof(keepalive));
+        setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &keepidle, sizeof(keepidle));
+        setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &keepintvl, sizeof(keepintvl));
+        setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &keepcnt, sizeof(keepcnt));
+        ESP_LOGI(TAG, "Host connected");
+
+        xSemaphoreTake(s_client_lock, portMAX_DELAY);
+        s_client = sock;
+        xSemaphoreGive(s_client_lock);
+        serve_client(sock, rx_buffer);
+
+        // shut down first so that a send blocked on a full window returns, then
+        // the descriptor is only closed once no sender can still hold it
+        shutdown(sock, SHUT_RDWR);
+        xSemaphoreTake(s_client_lock, portMAX_DELAY);
+        s_client = -1;
+        xSemaphoreGive(s_client_lock);
+        close(sock);
+    }
+
+exit:
+    if (listen_sock >= 0)
+        close(listen_sock);
+    free(rx_buffer);
+    vTaskDelete(NULL);
+}
@@ -0,0 +1,31 @@
+/* HCI-IP TCP stream transport
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * @brief: Accept one host at a time on CONFIG_HCI_IP_PORT and feed its H4
+ *         stream to the controller
+ */
+void tcp_server_task(void *pvParameters);
+
+/*
+ * @brief: Upstream transport for hci_uplink, writes to the connected host
+ */
+int tcp_send_upstream(const uint8_t *data, uint16_t len);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,324 @@
+/* HCI-IP raw lwIP UDP backend
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+#include <errno.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "lwip/udp.h"
+#include "lwip/pbuf.h"
+#include "lwip/priv/tcpip_priv.h"
+#include "hci_proto.h"
+#include "hci_lat.h"
+#include "hci_aead.h"
+#include "hci_session.h"
+#include "hci_udp_raw.h"
+
+#define PORT                CONFIG_HCI_IP_PORT
+#define RAW_RX_MAX          HCI_IP_MAX_DGRAM_SIZE
+// same depth as the socket receive mailbox would give
+#define RAW_RX_QUEUE_LEN    16
+
+static const char *TAG = "HCI_UDP_RAW";
+
+typedef struct {
+    struct pbuf *p;
+    uint32_t stamp;
+    ip_addr_t addr;
+    uint16_t port;
+} raw_dgram_t;
+
+typedef struct {
+    struct tcpip_api_call_data call;
+    const struct iovec *iov;
+    int iovcnt;
+} raw_send_msg_t;
+
+typedef struct {
+    struct tcpip_api_call_data call;
+    bool expired;
+} raw_close_msg_t;
+
+typedef struct {
+    struct tcpip_api_call_data call;
+    bool changed;
+} raw_accept_msg_t;
+
+static QueueHandle_t s_rx_queue;
+static raw_dgram_t s_current;                   // datagram being dispatched, receive task only
+static uint8_t s_bounce[RAW_RX_MAX];            // for datagrams spread over a pbuf chain
+
+// pcb and peer are only changed in lwIP context, on behalf of the receive task
+static struct udp_pcb *s_pcb;
+static ip_addr_t s_peer_ip;
+static uint16_t s_peer_port;
+static bool s_has_peer;
+static volatile bool s_connected;
+
+static hci_session_stats_t s_session_stats;
+static hci_udp_raw_stats_t s_stats;
+
+/*
+ * @brief: udp_pcb receive callback, lwIP context with the core lock held.
+ *         Only queues the pbuf, dispatching may block on the controller
+ */
+static void raw_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port)
+{
+    raw_dgram_t dg = { .p = p, .stamp = hci_lat_now(), .port = port };
+
+    if (p->tot_len == 0 || p->tot_len > RAW_RX_MAX) {
+        s_stats.oversize++;
+        pbuf_free(p);
+        return;
+    }
+
+    // the receive task decides whether the sender gets the session
+    ip_addr_copy(dg.addr, *addr);
+    if (xQueueSend(s_rx_queue, &dg, 0) != pdTRUE) {
+        s_stats.queue_full++;
+        pbuf_free(p);
+    }
+}
+
+static err_t raw_start_fn(struct tcpip_api_call_data *call)
+{
+    s_pcb = udp_new_ip_type(IPADDR_TYPE_ANY);
+    if (!s_pcb)
+        return ERR_MEM;
+
+    err_t err = udp_bind(s_pcb, IP_ANY_TYPE, PORT);
+    if (err != ERR_OK) {
+        udp_remove(s_pcb);
+        s_pcb = NULL;
+        return err;
+    }
+    udp_recv(s_pcb, raw_recv, NULL);
+    return ERR_OK;
+}
+
+static err_t raw_send_fn(struct tcpip_api_call_data *call)
+{
+    raw_send_msg_t *msg = (raw_send_msg_t *)call;
+
+    if (!s_pcb || !s_has_peer)
+        return ERR_CONN;
+
+    // the buffers are referenced, not copied, lwIP chains its headers in front of the first one
+    struct pbuf *p = NULL;
+    for (int i = 0; i < msg->iovcnt; i++) {
+        struct pbuf *q = pbuf_alloc(p ? PBUF_RAW : PBUF_TRANSPORT, msg->iov[i].iov_len, PBUF_REF);
+        if (!q) {
+            if (p)
+                pbuf_free(p);
+            return ERR_MEM;
+        }
+        q->payload = msg->iov[i].iov_base;
+        if (p)
+            pbuf_cat(p, q);
+        else
+            p = q;
+    }
+    if (!p)
+        return ERR_ARG;
+
+    err_t err = s_connected ? udp_send(s_pcb, p) : udp_sendto(s_pcb, p, &s_peer_ip, s_peer_port);
+    pbuf_free(p);
+    return err;
+}
+
+static err_t raw_accept_fn(struct tcpip_api_call_data *call)
+{
+    raw_accept_msg_t *msg = (raw_accept_msg_t *)call;
+
+    if (s_connected)
+        return ERR_ISCONN;
+
+    msg->changed = !s_has_peer || s_peer_port != s_current.port || !ip_addr_cmp(&s_peer_ip, &s_current.addr);
+    err_t err = udp_connect(s_pcb, &s_current.addr, s_current.port);
+    if (err != ERR_OK) {
+        msg->changed = false;
+        s_session_stats.connect_errors++;
+        return err;
+    }
+    ip_addr_copy(s_peer_ip, s_current.addr);
+    s_peer_port = s_current.port;
+    s_has_peer = true;
+    s_connected = true;
+    s_session_stats.established++;
+    if (msg->changed)
+        s_session_stats.peer_changes++;
+    return ERR_OK;
+}
+
+static err_t raw_reply_fn(struct tcpip_api_call_data *call)
+{
+    raw_send_msg_t *msg = (raw_send_msg_t *)call;
+
+    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, msg->iov[0].iov_len, PBUF_REF);
+    if (!p)
+        return ERR_MEM;
+    p->payload = msg->iov[0].iov_base;
+    err_t err = udp_sendto(s_pcb, p, &s_current.addr, s_current.port);
+    pbuf_free(p);
+    return err;
+}
+
+static err_t raw_close_fn(struct tcpip_api_call_data *call)
+{
+    raw_close_msg_t *msg = (raw_close_msg_t *)call;
+
+    if (!s_connected)
+        return ERR_CONN;
+
+    udp_disconnect(s_pcb);
+    s_connected = false;
+    if (msg->expired)
+        s_session_stats.expired++;
+    else
+        s_session_stats.byes++;
+    return ERR_OK;
+}
+
+esp_err_t hci_udp_raw_start(void)
+{
+    struct tcpip_api_call_data call;
+
+    s_rx_queue = xQueueCreate(RAW_RX_QUEUE_LEN, sizeof(raw_dgram_t));
+    if (!s_rx_queue)
+        return ESP_ERR_NO_MEM;
+
+    err_t err = tcpip_api_call(raw_start_fn, &call);
+    if (err != ERR_OK) {
+        ESP_LOGE(TAG, "Unable to bind port %d: err %d", PORT, err);
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Raw UDP pcb bound, port %d", PORT);
+    return ESP_OK;
+}
+
+int hci_udp_raw_recv(uint8_t **data, uint32_t *stamp, TickType_t wait)
+{
+    raw_dgram_t dg;
+
+    if (s_current.p) {
+        pbuf_free(s_current.p);
+        s_current.p = NULL;
+    }
+
+    if (xQueueReceive(s_rx_queue, &dg, wait) != pdTRUE)
+        return 0;
+
+    s_current = dg;
+    *stamp = dg.stamp;
+    s_stats.received++;
+
+    // Wi-Fi delivers a datagram in one pbuf, use it in place
+    if (dg.p->len == dg.p->tot_len) {
+        *data = dg.p->payload;
+    } else {
+        pbuf_copy_partial(dg.p, s_bounce, dg.p->tot_len, 0);
+        *data = s_bounce;
+        s_stats.copied++;
+    }
+    return dg.p->tot_len;
+}
+
+bool hci_udp_raw_accept(bool *new_host)
+{
+    raw_accept_msg_t msg = { .changed = false };
+
+    *new_host = false;
+    // the peer only changes below, in this task, so it is read without the core lock
+    if (s_connected) {
+        if (s_current.port == s_peer_port && ip_addr_cmp(&s_current.addr, &s_peer_ip))
+            return true;
+        // queued before the pcb was connected to the session host
+        s_stats.not_session++;
+        return false;
+    }
+
+    // a failed connect still lets the datagram through, replies then go with sendto
+    tcpip_api_call(raw_accept_fn, &msg.call);
+    *new_host = msg.changed;
+    return true;
+}
+
+int hci_udp_raw_reply(const uint8_t *data, uint16_t len)
+{
+    struct iovec iov = { .iov_base = (void *)data, .iov_len = len };
+    raw_send_msg_t msg = { .iov = &iov, .iovcnt = 1 };
+
+    err_t err = tcpip_api_call(raw_reply_fn, &msg.call);
+    if (err != ERR_OK) {
+        errno = err_to_errno(err);
+        return -1;
+    }
+    return len;
+}
+
+void hci_udp_raw_get_stats(hci_udp_raw_stats_t *stats)
+{
+    *stats = s_stats;
+}
+
+bool hci_session_established(void)
+{
+    return s_connected;
+}
+
+static int session_sendv(const struct iovec *iov, int iovcnt)
+{
+    raw_send_msg_t msg = { .iov = iov, .iovcnt = iovcnt };
+
+    // with LWIP_TCPIP_CORE_LOCKING this runs right here under the core lock
+    err_t err = tcpip_api_call(raw_send_fn, &msg.call);
+    if (err != ERR_OK) {
+        errno = err_to_errno(err);
+        return -1;
+    }
+
+    int len = 0;
+    for (int i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+    return len;
+}
+
+int hci_session_sendv(const struct iovec *iov, int iovcnt)
+{
+#ifdef CONFIG_HCI_IP_AEAD
+    if (hci_aead_enabled())
+        return hci_aead_sendv(iov, iovcnt, session_sendv);
+#endif
+    return session_sendv(iov, iovcnt);
+}
+
+int hci_session_send(const uint8_t *data, uint16_t len)
+{
+    struct iovec iov = { .iov_base = (void *)data, .iov_len = len };
+
+    return hci_session_sendv(&iov, 1);
+}
+
+void hci_session_close(bool expired)
+{
+    raw_close_msg_t msg = { .expired = expired };
+
+    if (tcpip_api_call(raw_close_fn, &msg.call) != ERR_OK)
+        return;
+
+    if (expired)
+        ESP_LOGI(TAG, "Host idle, session released");
+    else
+        ESP_LOGI(TAG, "Host ended the session");
+}
+
+void hci_session_get_stats(hci_session_stats_t *stats)
+{
+    *stats = s_session_stats;
+}
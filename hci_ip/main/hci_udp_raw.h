@@ -0,0 +1,74 @@
+/* HCI-IP raw lwIP UDP backend
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Alternative to the BSD socket path, selected with HCI_IP_UDP_RAW. A udp_pcb
+ * bound to CONFIG_HCI_IP_PORT receives in lwIP context and hands the pbuf to
+ * the receive task through a queue, without netbuf or copy into a socket
+ * buffer. Upstream datagrams reference the caller's buffer with a PBUF_REF
+ * and are sent under the lwIP core lock, the tcpip thread mailbox is only
+ * used when core locking is disabled.
+ *
+ * The session rules of hci_session.h apply unchanged, this file provides
+ * hci_session_send(), hci_session_close() and friends for this backend. The
+ * receive task calls hci_udp_raw_accept() in place of hci_session_accept().
+ */
+
+typedef struct {
+    uint32_t received;      /* datagrams handed to the receive task */
+    uint32_t copied;        /* spread over several pbufs, copied into one buffer */
+    uint32_t queue_full;    /* dropped, the receive task fell behind */
+    uint32_t oversize;      /* dropped, larger than any proxy packet */
+    uint32_t not_session;   /* dropped, from another host than the session one */
+} hci_udp_raw_stats_t;
+
+/*
+ * @brief: Create the pcb and start receiving
+ */
+esp_err_t hci_udp_raw_start(void);
+
+/*
+ * @brief: Wait for the next host datagram, receive task only. The data stays
+ *         valid until the next call
+ * params: stamp: hci_lat_now() at reception in lwIP context
+ * return: datagram length, 0 if nothing arrived within wait
+ */
+int hci_udp_raw_recv(uint8_t **data, uint32_t *stamp, TickType_t wait);
+
+/*
+ * @brief: Give an idle session to the sender of the last received datagram,
+ *         receive task only
+ * params: new_host: true if a different host took over the session
+ * return: false if the session belongs to another host, drop the datagram
+ */
+bool hci_udp_raw_accept(bool *new_host);
+
+/*
+ * @brief: Send one datagram in the clear to the sender of the last received
+ *         datagram, without touching the session. Receive task only
+ * return: len, or -1 with errno set
+ */
+int hci_udp_raw_reply(const uint8_t *data, uint16_t len);
+
+void hci_udp_raw_get_stats(hci_udp_raw_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,611 @@
+/* HCI-IP controller to host path
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "hci_proto.h"
+#include "hci_ctrl.h"
+#include "hci_rel.h"
+#include "hci_adv_cache.h"
+#include "hci_lz.h"
+#include "hci_lat.h"
+#include "hci_task.h"
+#include "hci_uplink.h"
+
+#define BUNDLE_MTU          CONFIG_HCI_IP_BUNDLE_MTU
+#define BUNDLE_FLUSH_US     CONFIG_HCI_IP_BUNDLE_FLUSH_US
+
+// a full bundle still fits one unfragmented datagram as a sealed reliable frame
+_Static_assert(BUNDLE_MTU + HCI_IP_REL_DATA_HDR + HCI_IP_AEAD_OVERHEAD <= HCI_IP_UDP_PAYLOAD_MAX,
+               "HCI_IP_BUNDLE_MTU leaves no room for the reliability and encryption headers");
+#ifdef CONFIG_HCI_IP_COMPRESS
+#define COMPRESS_MIN_LEN    CONFIG_HCI_IP_COMPRESS_MIN_LEN
+#endif
+
+/* HCI events that gate the host's next command or ACL packet */
+#define EVT_CMD_COMPLETE    0x0e
+#define EVT_CMD_STATUS      0x0f
+#define EVT_NUM_COMP_PKTS   0x13
+/* connection lifecycle, sent in order with ACL data and everything after them */
+#define EVT_CONN_CMPL       0x03
+#define EVT_DISCONN_CMPL    0x05
+#define EVT_ENC_CHANGE      0x08
+#define EVT_ENC_CHANGE_V2   0x59
+#define EVT_LE_META         0x3e
+#define SUBEVT_LE_CONN_CMPL         0x01
+#define SUBEVT_LE_ENH_CONN_CMPL     0x0a
+#define SUBEVT_LE_ENH_CONN_CMPL_V2  0x29
+
+/* ring record flags: arrival order, and a lifecycle event in the ACL ring.
+ * The sequence space is well above the number of records the rings hold */
+#define REC_SEQ_MASK        0x3fff
+#define REC_LIFECYCLE       0x4000
+
+/* share of CONFIG_HCI_IP_C2H_RING_SIZE per class, in eighths */
+#define RING_SHARE_CMD      1
+#define RING_SHARE_SCO      1
+#define RING_SHARE_EVT      2
+#define RING_SHARE_ACL      4
+
+/* records per bundle, each one takes two iovecs after the bundle type byte */
+#define BUNDLE_MAX_RECS     32
+
+#define RING_SIZE(share)    ((CONFIG_HCI_IP_C2H_RING_SIZE / 8 * (share)) & ~3)
+
+static const char *TAG = "HCI_UPLINK";
+
+static hci_uplink_send_fn s_send;
+static hci_uplink_sendv_fn s_sendv;
+static TaskHandle_t s_task;
+static hci_uplink_tx_stats_t s_tx_stats;      // written by upstream_tx_task() only
+
+// controller to host packets per class, filled by hci_uplink_put() and drained by upstream_tx_task()
+static hci_ring_t s_rings[HCI_UPLINK_PRIO_NUM];
+static uint8_t s_ring_cmd[RING_SIZE(RING_SHARE_CMD)] __attribute__((aligned(4)));
+static uint8_t s_ring_sco[RING_SIZE(RING_SHARE_SCO)] __attribute__((aligned(4)));
+static uint8_t s_ring_evt[RING_SIZE(RING_SHARE_EVT)] __attribute__((aligned(4)));
+static uint8_t s_ring_acl[RING_SIZE(RING_SHARE_ACL)] __attribute__((aligned(4)));
+
+// Lifecycle events wait in the ACL ring behind older ACL data. While one is
+// there, packets of other classes that arrived after it are held back, so
+// nothing about a connection reaches the host before it is set up or after
+// it is torn down
+static uint16_t s_put_seq;                  // controller context only
+static atomic_uint s_lifecycle_put;         // lifecycle events queued
+static uint32_t s_lifecycle_taken;          // taken off the ACL ring, upstream task only
+static bool s_barrier_valid;                // s_barrier_seq is known, upstream task only
+static uint16_t s_barrier_seq;              // oldest lifecycle event still queued
+
+#ifdef CONFIG_HCI_IP_UPLINK_SCHED_WEIGHTED
+// packets each class may send per round, only touched by upstream_tx_task()
+static const uint8_t s_weights[HCI_UPLINK_PRIO_NUM] = {
+    CONFIG_HCI_IP_UPLINK_WEIGHT_CMD,
+    CONFIG_HCI_IP_UPLINK_WEIGHT_SCO,
+    CONFIG_HCI_IP_UPLINK_WEIGHT_EVT,
+    CONFIG_HCI_IP_UPLINK_WEIGHT_ACL,
+};
+static uint8_t s_credits[HCI_UPLINK_PRIO_NUM];
+#endif
+
+// pending multi-record datagram, only touched by upstream_tx_task(). Only
+// the framing lives here, the packets are sent from their rings
+static uint8_t s_bundle_type = HCI_IP_PKT_BUNDLE;
+static uint8_t s_bundle_hdr[BUNDLE_MAX_RECS][HCI_IP_BUNDLE_REC_HDR];
+static struct iovec s_bundle_iov[1 + 2 * BUNDLE_MAX_RECS];
+static uint16_t s_bundle_recs;
+static uint16_t s_bundle_len;
+static int64_t s_bundle_first_us;
+static bool s_bundle_urgent;    // holds a command class packet, do not wait for the deadline
+static bool s_bundle_lz;        // only holds packets that may be compressed
+#ifdef CONFIG_HCI_IP_LATENCY
+static struct {
+    uint8_t type;
+    uint32_t in_stamp;          // host_rcv_pkt() entry
+    uint32_t pick_stamp;        // taken off the ring
+} s_bundle_stamps[BUNDLE_MAX_RECS];
+#endif
+// ring records held until the bundle is sent, including suppressed ones
+// behind them, and the last of them per class
+static uint16_t s_held[HCI_UPLINK_PRIO_NUM];
+static const uint8_t *s_held_last[HCI_UPLINK_PRIO_NUM];
+// a bundle is gathered here for transports without scatter-gather
+static uint8_t s_gather[BUNDLE_MTU + HCI_IP_BUNDLE_REC_HDR + HCI_IP_MAX_PKT_SIZE];
+static esp_timer_handle_t s_flush_timer;
+
+static void send_failed(void)
+{
+    ESP_LOGE(TAG, "Error occurred during upstream send: errno %d", errno);
+    s_tx_stats.send_errors++;
+    s_tx_stats.last_errno = errno;
+}
+
+static void send_all(const uint8_t *data, uint16_t len)
+{
+#ifdef CONFIG_HCI_IP_RELIABLE
+    if (hci_ctrl_features() & HCI_IP_FEAT_RELIABLE) {
+        struct iovec iov = { .iov_base = (void *)data, .iov_len = len };
+        // kept for retransmission, copied once into the retransmit slot
+        s_tx_stats.copied_bytes += len;
+        hci_rel_send(&iov, 1);
+        return;
+    }
+#endif
+
+    int txBytes = 0;
+    do
+    {
+      int sent = s_send(&data[txBytes], len - txBytes);
+      if (sent < 0) {
+        send_failed();
+        return;
+      }
+#ifdef HCI_PROTO_DEBUG
+      else if (txBytes + sent < len)
+        ESP_LOGI(TAG, "More data to send upstream: %i, %i", txBytes + sent, len);
+      else
+        ESP_LOGI(TAG, "Data sent finished: %i", len);
+#endif
+      txBytes += sent;
+    } while (txBytes < len);
+
+#ifdef HCI_PROTO_DEBUG
+    ESP_LOG_BUFFER_HEXDUMP(TAG, data, len, ESP_LOG_INFO);
+#endif
+}
+
+/*
+ * @brief: Send one datagram made of several buffers
+ */
+static void send_gather(const struct iovec *iov, int iovcnt, uint16_t len)
+{
+#ifdef CONFIG_HCI_IP_RELIABLE
+    if (hci_ctrl_features() & HCI_IP_FEAT_RELIABLE) {
+        // kept for retransmission, gathered once into the retransmit slot
+        s_tx_stats.copied_bytes += len;
+        hci_rel_send(iov, iovcnt);
+        return;
+    }
+#endif
+
+    if (s_sendv) {
+        if (s_sendv(iov, iovcnt) < 0)
+            send_failed();
+        return;
+    }
+
+    uint16_t pos = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(&s_gather[pos], iov[i].iov_base, iov[i].iov_len);
+        pos += iov[i].iov_len;
+    }
+    s_tx_stats.copied_bytes += pos;
+    send_all(s_gather, pos);
+}
+
+/*
+ * @brief: Compress a datagram if the host asked for it and it only carries
+ *         events that do not gate the host
+ * return: compressed length, 0 to send the datagram as is
+ */
+static uint16_t compress(const struct iovec *iov, int iovcnt, uint16_t len, bool allowed, const uint8_t **out)
+{
+#ifdef CONFIG_HCI_IP_COMPRESS
+    if (allowed && len >= COMPRESS_MIN_LEN && (hci_ctrl_features() & HCI_IP_FEAT_COMPRESS))
+        return hci_lz_compress(iov, iovcnt, len, out);
+#endif
+    return 0;
+}
+
+/*
+ * @brief: Oldest packet of a class that the bundle does not hold yet
+ */
+static uint8_t *next_record(int prio, uint16_t *len)
+{
+    if (s_held_last[prio])
+        return hci_ring_peek_next(&s_rings[prio], s_held_last[prio], len, NULL);
+    return hci_ring_peek(&s_rings[prio], len, NULL);
+}
+
+static void hold(int prio, const uint8_t *data)
+{
+    s_held[prio]++;
+    s_held_last[prio] = data;
+}
+
+/*
+ * @brief: Done with a packet that is not bundled
+ */
+static void release(int prio, const uint8_t *data)
+{
+    // packets behind a held one leave the ring together with it
+    if (s_held[prio])
+        hold(prio, data);
+    else
+        hci_ring_pop(&s_rings[prio]);
+}
+
+static void bundle_flush(void)
+{
+    if (s_bundle_recs) {
+        const uint8_t *lz;
+        uint16_t lz_len = compress(s_bundle_iov, 1 + 2 * s_bundle_recs, s_bundle_len, s_bundle_lz, &lz);
+        if (lz_len)
+            send_all(lz, lz_len);
+        else
+            send_gather(s_bundle_iov, 1 + 2 * s_bundle_recs, s_bundle_len);
+    }
+#ifdef CONFIG_HCI_IP_LATENCY
+    uint32_t now = hci_lat_now();
+    for (int i = 0; i < s_bundle_recs; i++) {
+        hci_lat_record(HCI_LAT_C2H_SEND, s_bundle_stamps[i].type, s_bundle_stamps[i].pick_stamp, now);
+        hci_lat_record(HCI_LAT_C2H_TOTAL, s_bundle_stamps[i].type, s_bundle_stamps[i].in_stamp, now);
+    }
+#endif
+
+    // the packets are out, give their ring space back
+    for (int prio = 0; prio < HCI_UPLINK_PRIO_NUM; prio++) {
+        uint16_t len;
+        for (; s_held[prio]; s_held[prio]--) {
+            // peek first, it steps over a wrap marker
+            hci_ring_peek(&s_rings[prio], &len, NULL);
+            hci_ring_pop(&s_rings[prio]);
+        }
+        s_held_last[prio] = NULL;
+    }
+
+    s_bundle_recs = 0;
+    s_bundle_len = 0;
+    s_bundle_urgent = false;
+    esp_timer_stop(s_flush_timer);
+}
+
+static void bundle_add(int prio, const uint8_t *data, uint16_t len, uint32_t in_stamp, uint32_t pick_stamp)
+{
+    if (s_bundle_recs == BUNDLE_MAX_RECS ||
+        (s_bundle_recs && s_bundle_len + HCI_IP_BUNDLE_REC_HDR + len > BUNDLE_MTU))
+        bundle_flush();
+
+    if (s_bundle_recs == 0) {
+        s_bundle_iov[0].iov_base = &s_bundle_type;
+        s_bundle_iov[0].iov_len = 1;
+        s_bundle_len = 1;
+        s_bundle_first_us = esp_timer_get_time();
+        s_bundle_lz = true;
+    }
+
+    uint8_t *hdr = s_bundle_hdr[s_bundle_recs];
+    hdr[0] = len & 0xff;
+    hdr[1] = len >> 8;
+    struct iovec *iov = &s_bundle_iov[1 + 2 * s_bundle_recs];
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = HCI_IP_BUNDLE_REC_HDR;
+    iov[1].iov_base = (void *)data;
+    iov[1].iov_len = len;
+    hold(prio, data);
+    s_bundle_len += HCI_IP_BUNDLE_REC_HDR + len;
+    // latency critical packets are not held up by the compressor
+    if (prio != HCI_UPLINK_PRIO_EVT)
+        s_bundle_lz = false;
+#ifdef CONFIG_HCI_IP_LATENCY
+    s_bundle_stamps[s_bundle_recs].type = data[0];
+    s_bundle_stamps[s_bundle_recs].in_stamp = in_stamp;
+    s_bundle_stamps[s_bundle_recs].pick_stamp = pick_stamp;
+#endif
+    s_bundle_recs++;
+
+    // a single packet larger than the MTU goes out on its own
+    if (s_bundle_len >= BUNDLE_MTU)
+        bundle_flush();
+}
+
+/*
+ * @brief: Events that create or end a connection or change its encryption
+ */
+static bool is_lifecycle(const uint8_t *data, uint16_t len)
+{
+    if (data[0] != H4_TYPE_EVENT || len < 2)
+        return false;
+    switch (data[1])
+    {
+      case EVT_CONN_CMPL:
+      case EVT_DISCONN_CMPL:
+      case EVT_ENC_CHANGE:
+      case EVT_ENC_CHANGE_V2:
+        return true;
+      case EVT_LE_META:
+        return len > 3 && (data[3] == SUBEVT_LE_CONN_CMPL || data[3] == SUBEVT_LE_ENH_CONN_CMPL ||
+                           data[3] == SUBEVT_LE_ENH_CONN_CMPL_V2);
+      default:
+        return false;
+    }
+}
+
+static hci_uplink_prio_t classify(const uint8_t *data, uint16_t len)
+{
+    switch (data[0])
+    {
+      case H4_TYPE_EVENT:
+        if (len > 1 && (data[1] == EVT_CMD_COMPLETE || data[1] == EVT_CMD_STATUS ||
+                        data[1] == EVT_NUM_COMP_PKTS))
+            return HCI_UPLINK_PRIO_CMD;
+        // the host gets all data of a link before its handle goes away, and
+        // the handle before any data
+        if (is_lifecycle(data, len))
+            return HCI_UPLINK_PRIO_ACL;
+        return HCI_UPLINK_PRIO_EVT;
+      case H4_TYPE_SCO:
+      case H4_TYPE_ISO:
+        return HCI_UPLINK_PRIO_SCO;
+      default:
+        return HCI_UPLINK_PRIO_ACL;
+    }
+}
+
+/*
+ * @brief: Find the oldest lifecycle event the bundle does not hold yet
+ * return: false if there is none
+ */
+static bool lifecycle_barrier(uint16_t *seq)
+{
+    if (!s_barrier_valid) {
+        // only searched for after one was taken or a new one was queued
+        if (atomic_load(&s_lifecycle_put) == s_lifecycle_taken)
+            return false;
+        hci_ring_t *ring = &s_rings[HCI_UPLINK_PRIO_ACL];
+        uint16_t len, flags;
+        const uint8_t *data = s_held_last[HCI_UPLINK_PRIO_ACL] ?
+                              hci_ring_peek_next(ring, s_held_last[HCI_UPLINK_PRIO_ACL], &len, &flags) :
+                              hci_ring_peek(ring, &len, &flags);
+        while (data && !(flags & REC_LIFECYCLE))
+            data = hci_ring_peek_next(ring, data, &len, &flags);
+        if (!data)
+            return false;
+        s_barrier_seq = flags & REC_SEQ_MASK;
+        s_barrier_valid = true;
+    }
+    *seq = s_barrier_seq;
+    return true;
+}
+
+/*
+ * @brief: True if a packet arrived after the lifecycle event with seq barrier
+ */
+static bool after_barrier(const uint8_t *data, uint16_t barrier)
+{
+    uint16_t seq = hci_ring_rec(data)->flags & REC_SEQ_MASK;
+    return seq != barrier && ((seq - barrier) & REC_SEQ_MASK) < (REC_SEQ_MASK + 1) / 2;
+}
+
+/*
+ * @brief: Oldest packet of a class that may be sent now
+ */
+static uint8_t *ready_record(int prio, bool barrier, uint16_t barrier_seq, uint16_t *len)
+{
+    uint8_t *data = next_record(prio, len);
+
+    if (data && barrier && prio != HCI_UPLINK_PRIO_ACL && after_barrier(data, barrier_seq))
+        return NULL;
+    return data;
+}
+
+/*
+ * @brief: Take the next packet of the class returned by next_class()
+ */
+static uint8_t *take_record(int prio, uint16_t *len)
+{
+    uint8_t *data = next_record(prio, len);
+
+    if (hci_ring_rec(data)->flags & REC_LIFECYCLE) {
+        s_lifecycle_taken++;
+        s_barrier_valid = false;
+    }
+    return data;
+}
+
+/*
+ * @brief: Pick the class to send from next, -1 when all rings are empty
+ */
+static int next_class(void)
+{
+    uint16_t len;
+    uint16_t barrier_seq = 0;
+    bool barrier = lifecycle_barrier(&barrier_seq);
+
+#ifdef CONFIG_HCI_IP_UPLINK_SCHED_WEIGHTED
+    // classes with credit left go in priority order, refill once every
+    // backlogged class has used its share of the round
+    for (int round = 0; round < 2; round++) {
+        bool backlog = false;
+        for (int prio = 0; prio < HCI_UPLINK_PRIO_NUM; prio++) {
+            if (!ready_record(prio, barrier, barrier_seq, &len))
+                continue;
+            backlog = true;
+            if (s_credits[prio]) {
+                s_credits[prio]--;
+                return prio;
+            }
+        }
+        if (!backlog)
+            return -1;
+        memcpy(s_credits, s_weights, sizeof(s_credits));
+    }
+    return -1;
+#else
+    for (int prio = 0; prio < HCI_UPLINK_PRIO_NUM; prio++) {
+        if (ready_record(prio, barrier, barrier_seq, &len))
+            return prio;
+    }
+    return -1;
+#endif
+}
+
+static void flush_timer_cb(void *arg)
+{
+    xTaskNotifyGive(s_task);
+}
+
+/*
+ * @brief: Drain the controller to host rings by priority and send each packet upstream
+ */
+static void upstream_tx_task(void *pvParameters)
+{
+    uint32_t last_overflows[HCI_UPLINK_PRIO_NUM] = { 0 };
+    TickType_t wait = portMAX_DELAY;
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, wait);
+
+        bool bundling = hci_ctrl_features() & HCI_IP_FEAT_BUNDLE;
+        int prio;
+        while ((prio = next_class()) >= 0) {
+            uint16_t len;
+            uint8_t *data = take_record(prio, &len);
+            uint32_t in_stamp = hci_ring_rec(data)->stamp;
+            uint32_t pick_stamp = hci_lat_now();
+            hci_lat_record(HCI_LAT_C2H_RING, data[0], in_stamp, pick_stamp);
+#ifdef CONFIG_HCI_IP_ADV_CACHE
+            // repeated advertising reports never leave the target
+            if (hci_adv_cache_suppress(data, len, esp_timer_get_time())) {
+                release(prio, data);
+                continue;
+            }
+#endif
+            if (data[0] < 6) {
+                s_tx_stats.pkts[data[0]]++;
+                s_tx_stats.bytes[data[0]] += len;
+            }
+            if (bundling) {
+                // the packet stays in its ring until the bundle is sent
+                bundle_add(prio, data, len, in_stamp, pick_stamp);
+                if (prio == HCI_UPLINK_PRIO_CMD && s_bundle_recs)
+                    s_bundle_urgent = true;
+            } else {
+                // only left over when bundling was just turned off
+                if (s_bundle_recs)
+                    bundle_flush();
+                const uint8_t *lz;
+                struct iovec iov = { .iov_base = data, .iov_len = len };
+                uint16_t lz_len = compress(&iov, 1, len, prio == HCI_UPLINK_PRIO_EVT, &lz);
+                if (lz_len)
+                    send_all(lz, lz_len);
+                else
+                    send_all(data, len);
+                uint32_t now = hci_lat_now();
+                hci_lat_record(HCI_LAT_C2H_SEND, data[0], pick_stamp, now);
+                hci_lat_record(HCI_LAT_C2H_TOTAL, data[0], in_stamp, now);
+                release(prio, data);
+            }
+        }
+
+        // rings are empty, hold a partial bundle until its flush deadline
+        if (s_bundle_recs) {
+            int64_t age = esp_timer_get_time() - s_bundle_first_us;
+            if (!bundling || s_bundle_urgent || age >= BUNDLE_FLUSH_US)
+                bundle_flush();
+            else if (!esp_timer_is_active(s_flush_timer))
+                esp_timer_start_once(s_flush_timer, BUNDLE_FLUSH_US - age);
+        }
+
+        wait = portMAX_DELAY;
+#ifdef CONFIG_HCI_IP_RELIABLE
+        // retransmit lost frames, come back before the oldest one times out
+        if (hci_ctrl_features() & HCI_IP_FEAT_RELIABLE)
+            wait = hci_rel_poll();
+#endif
+
+        // overflows are counted in controller context, report them from here
+        for (int i = 0; i < HCI_UPLINK_PRIO_NUM; i++) {
+            hci_ring_stats_t stats;
+            hci_ring_get_stats(&s_rings[i], &stats);
+            if (stats.overflows != last_overflows[i]) {
+                ESP_LOGW(TAG, "C2H ring %d overflow: dropped %" PRIu32 ", high water %" PRIu32 " packets",
+                         i, stats.overflows, stats.high_water);
+                last_overflows[i] = stats.overflows;
+            }
+        }
+    }
+}
+
+esp_err_t hci_uplink_start(hci_uplink_send_fn send, hci_uplink_sendv_fn sendv)
+{
+    s_send = send;
+    s_sendv = sendv;
+    hci_ring_init(&s_rings[HCI_UPLINK_PRIO_CMD], s_ring_cmd, sizeof(s_ring_cmd));
+    hci_ring_init(&s_rings[HCI_UPLINK_PRIO_SCO], s_ring_sco, sizeof(s_ring_sco));
+    hci_ring_init(&s_rings[HCI_UPLINK_PRIO_EVT], s_ring_evt, sizeof(s_ring_evt));
+    hci_ring_init(&s_rings[HCI_UPLINK_PRIO_ACL], s_ring_acl, sizeof(s_ring_acl));
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = flush_timer_cb,
+        .name = "bundle_flush",
+    };
+    esp_err_t err = esp_timer_create(&timer_args, &s_flush_timer);
+    if (err != ESP_OK)
+        return err;
+
+#ifdef CONFIG_HCI_IP_RELIABLE
+    err = hci_rel_init(send, hci_uplink_kick);
+    if (err != ESP_OK)
+        return err;
+#endif
+
+#ifdef CONFIG_HCI_IP_ADV_CACHE
+    err = hci_adv_cache_init();
+    if (err != ESP_OK)
+        return err;
+#endif
+
+#ifdef CONFIG_HCI_IP_COMPRESS
+    err = hci_lz_init();
+    if (err != ESP_OK)
+        return err;
+#endif
+
+    if (xTaskCreatePinnedToCore(&upstream_tx_task, "upstream_tx_task", HCI_IP_UPLINK_TASK_STACK, NULL,
+                                HCI_IP_UPLINK_TASK_PRIO, &s_task, HCI_IP_UPLINK_TASK_CORE) != pdPASS)
+        return ESP_ERR_NO_MEM;
+    return ESP_OK;
+}
+
+int hci_uplink_put(const uint8_t *data, uint16_t len, uint32_t stamp)
+{
+    bool lifecycle = is_lifecycle(data, len);
+    uint16_t flags = (s_put_seq++ & REC_SEQ_MASK) | (lifecycle ? REC_LIFECYCLE : 0);
+
+    if (!hci_ring_push(&s_rings[classify(data, len)], data, len, flags, stamp))
+        return -1;
+    // counted after the push, so the upstream task finds it in the ring
+    if (lifecycle)
+        atomic_fetch_add(&s_lifecycle_put, 1);
+
+    if (s_task)
+        xTaskNotifyGive(s_task);
+    return 0;
+}
+
+void hci_uplink_kick(void)
+{
+    if (s_task)
+        xTaskNotifyGive(s_task);
+}
+
+void hci_uplink_get_stats(hci_uplink_prio_t prio, hci_ring_stats_t *stats)
+{
+    hci_ring_get_stats(&s_rings[prio], stats);
+}
+
+void hci_uplink_get_tx_stats(hci_uplink_tx_stats_t *stats)
+{
+    *stats = s_tx_stats;
+}
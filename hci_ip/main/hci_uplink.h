@@ -0,0 +1,89 @@
+/* HCI-IP controller to host path
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "lwip/sockets.h"
+#include "hci_ring.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Upstream priority classes, 0 is served first. Packets keep their order
+ * within a class, each class has its own ring. Connection lifecycle events
+ * (Connection Complete, LE (Enhanced) Connection Complete, Disconnection
+ * Complete, Encryption Change) go with the ACL data, and no packet of another
+ * class that arrived after one of them is sent before it.
+ */
+typedef enum {
+    HCI_UPLINK_PRIO_CMD = 0,    /* Command Complete/Status, Number Of Completed Packets */
+    HCI_UPLINK_PRIO_SCO,        /* SCO and ISO data */
+    HCI_UPLINK_PRIO_EVT,        /* all other events */
+    HCI_UPLINK_PRIO_ACL,        /* ACL data, connection lifecycle events */
+    HCI_UPLINK_PRIO_NUM,
+} hci_uplink_prio_t;
+
+typedef struct {
+    uint32_t pkts[6];           /* packets handed to the transport, indexed by H4 type */
+    uint32_t bytes[6];          /* bytes handed to the transport, indexed by H4 type */
+    uint32_t send_errors;       /* transport writes that failed */
+    int32_t last_errno;         /* errno of the last failed write */
+    uint32_t copied_bytes;      /* copied after the ring: reliable frames, bundles without sendv */
+} hci_uplink_tx_stats_t;
+
+/*
+ * Transport hook used by the upstream task to write one datagram/frame
+ * return: bytes sent or -1 on error (errno is set)
+ */
+typedef int (*hci_uplink_send_fn)(const uint8_t *data, uint16_t len);
+
+/*
+ * Optional transport hook that writes one datagram gathered from several
+ * buffers. Bundles are then sent straight from the rings, with their framing
+ * in separate iovecs
+ * return: bytes sent or -1 on error (errno is set)
+ */
+typedef int (*hci_uplink_sendv_fn)(const struct iovec *iov, int iovcnt);
+
+/*
+ * @brief: Set up the controller to host rings and start the upstream task
+ * params: sendv: NULL if the transport has no scatter-gather write
+ */
+esp_err_t hci_uplink_start(hci_uplink_send_fn send, hci_uplink_sendv_fn sendv);
+
+/*
+ * @brief: Queue one controller packet in the ring of its priority class,
+ *         called from the VHCI callback
+ * params: stamp: hci_lat_now() when the controller handed the packet over
+ * return: 0 on success, -1 if the ring is full
+ */
+int hci_uplink_put(const uint8_t *data, uint16_t len, uint32_t stamp);
+
+/*
+ * @brief: Wake the upstream task, e.g. when acks free retransmit slots
+ */
+void hci_uplink_kick(void);
+
+/*
+ * @brief: Snapshot of the ring counters of one priority class
+ */
+void hci_uplink_get_stats(hci_uplink_prio_t prio, hci_ring_stats_t *stats);
+
+/*
+ * @brief: Snapshot of the upstream transport counters
+ */
+void hci_uplink_get_tx_stats(hci_uplink_tx_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,337 @@
+#!/usr/bin/env python3
+# HCI-IP link benchmark
+#
+# This code is in the Public Domain (or CC0 licensed, at your option.)
+#
+# Unless required by applicable law or agreed to in writing, this
+# software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+# CONDITIONS OF ANY KIND, either express or implied.
+#
+# Host side of the HCI-IP link benchmark (0x0a packets, see hci_proto.h).
+# Standard library only.
+#
+#   hci_ip_bench.py <target ip> echo   --count 1000 --size 64 --interval-us 10000
+#   hci_ip_bench.py <target ip> stream --count 5000 --size 1024 --interval-us 1000
+#   hci_ip_bench.py <target ip> sink   --count 5000 --size 1024 --interval-us 1000
+#
+# Modes that go through the controller, e.g. against the mock controller of
+# the linux target build:
+#
+#   hci_ip_bench.py <target ip> cmd    --count 1000 --interval-us 1000
+#   hci_ip_bench.py <target ip> acl    --count 5000 --size 251 --interval-us 1000
+#
+# Proxy internal latency per stage, see "Latency histograms" in README.md:
+#
+#   hci_ip_bench.py <target ip> lat-reset
+#   hci_ip_bench.py <target ip> lat
+
+import argparse
+import socket
+import struct
+import sys
+import time
+
+PKT_TEST = 0x0a
+OP_ECHO = 0x01
+OP_STREAM = 0x02
+OP_SINK = 0x03
+OP_RESET = 0x04
+OP_REPORT = 0x05
+RSP = 0x80
+
+H4_COMMAND = 0x01
+H4_ACL = 0x02
+H4_EVENT = 0x04
+EVT_CMD_COMPLETE = 0x0e
+OP_READ_BD_ADDR = 0x1009
+ACL_HANDLE = 0x0001
+
+PKT_CTRL = 0x0b
+CTRL_LAT_GET = 0x03
+CTRL_LAT_RSP = 0x04
+CTRL_LAT_RESET = 0x05
+LAT_BUCKETS = 20
+LAT_STAGES = ("h2c queue", "h2c total", "c2h ring", "c2h send", "c2h total")
+H4_TYPES = {1: "cmd", 2: "acl", 3: "sco", 4: "evt", 5: "iso"}
+
+PERCENTILES = (50, 90, 99, 99.9)
+
+
+def now_us():
+    return time.monotonic_ns() // 1000
+
+
+def percentile(sorted_values, p):
+    if not sorted_values:
+        return 0
+    rank = max(0, min(len(sorted_values) - 1, int(round(p / 100.0 * len(sorted_values) + 0.5)) - 1))
+    return sorted_values[rank]
+
+
+def print_distribution(name, values):
+    values = sorted(values)
+    if not values:
+        print(f"{name}: no samples")
+        return
+    parts = [f"p{p:g} {percentile(values, p)}" for p in PERCENTILES]
+    print(f"{name} (us): min {values[0]} " + " ".join(parts) + f" max {values[-1]}")
+
+
+def pace(start, seq, interval_us):
+    if interval_us:
+        delay = (start + seq * interval_us - now_us()) / 1e6
+        if delay > 0:
+            time.sleep(delay)
+
+
+def request_report(sock, op=OP_REPORT, timeout=1.0):
+    sock.send(bytes([PKT_TEST, op]))
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        sock.settimeout(max(0.01, deadline - time.monotonic()))
+        try:
+            data = sock.recv(2048)
+        except socket.timeout:
+            break
+        if len(data) >= 38 and data[0] == PKT_TEST and data[1] == OP_REPORT | RSP:
+            fields = struct.unpack_from("<9I", data, 2)
+            return dict(zip(("sink_pkts", "sink_bytes", "sink_lost", "sink_reordered", "sink_us",
+                             "stream_sent", "stream_errors", "stream_retries", "stream_us"), fields))
+    raise RuntimeError("no report from target")
+
+
+def run_echo(sock, args):
+    size = max(args.size, 14)
+    pad = bytes(size - 14)
+    sent = {}
+    rtts = []
+    start = now_us()
+
+    sock.setblocking(False)
+    for seq in range(args.count):
+        pace(start, seq, args.interval_us)
+        t = now_us()
+        sent[seq] = t
+        sock.send(struct.pack("<BBIII", PKT_TEST, OP_ECHO, seq, t & 0xffffffff, 0) + pad)
+        rtts += drain_echo(sock, sent)
+
+    deadline = time.monotonic() + args.timeout
+    while sent and time.monotonic() < deadline:
+        time.sleep(0.001)
+        rtts += drain_echo(sock, sent)
+
+    print(f"echo: {args.count} sent, {len(rtts)} received, {len(sent)} lost, {size} bytes")
+    print_distribution("round trip", rtts)
+
+
+def drain_echo(sock, sent):
+    rtts = []
+    while True:
+        try:
+            data = sock.recv(2048)
+        except BlockingIOError:
+            return rtts
+        if len(data) < 14 or data[0] != PKT_TEST or data[1] != OP_ECHO | RSP:
+            continue
+        seq = struct.unpack_from("<I", data, 2)[0]
+        t = sent.pop(seq, None)
+        if t is not None:
+            rtts.append(now_us() - t)
+
+
+def run_stream(sock, args):
+    request_report(sock, OP_RESET)
+    sock.send(struct.pack("<BBHII", PKT_TEST, OP_STREAM, args.size, args.count, args.interval_us))
+
+    received = 0
+    nbytes = 0
+    next_seq = 0
+    first = last = None
+    jitter = []
+    prev = None
+
+    sock.settimeout(args.timeout)
+    while received < args.count:
+        try:
+            data = sock.recv(2048)
+        except socket.timeout:
+            break
+        if len(data) < 10 or data[0] != PKT_TEST or data[1] != OP_STREAM | RSP:
+            continue
+        t = now_us()
+        seq, target_ts = struct.unpack_from("<II", data, 2)
+        received += 1
+        nbytes += len(data)
+        first = t if first is None else first
+        last = t
+        next_seq = max(next_seq, seq + 1)
+        # one-way delay variation: arrival spacing against target send spacing
+        if prev is not None:
+            jitter.append(abs((t - prev[0]) - ((target_ts - prev[1]) & 0xffffffff)))
+        prev = (t, target_ts)
+
+    report = request_report(sock)
+    # datagrams missing at the tail never show up as a sequence gap
+    lost = max(report["stream_sent"], next_seq) - received
+    secs = (last - first) / 1e6 if first is not None and last != first else 0
+    print(f"stream: target sent {report['stream_sent']} ({report['stream_errors']} errors, "
+          f"{report['stream_retries']} retries), received {received}, lost {lost}")
+    if secs:
+        print(f"upstream throughput: {nbytes * 8 / secs / 1e6:.2f} Mbit/s, {received / secs:.0f} datagrams/s")
+    print_distribution("delay variation", jitter)
+
+
+def run_sink(sock, args):
+    size = max(args.size, 6)
+    pad = bytes(size - 6)
+
+    request_report(sock, OP_RESET)
+    start = now_us()
+    for seq in range(args.count):
+        pace(start, seq, args.interval_us)
+        sock.send(struct.pack("<BBI", PKT_TEST, OP_SINK, seq) + pad)
+    host_secs = (now_us() - start) / 1e6
+
+    time.sleep(0.2)
+    report = request_report(sock)
+    secs = report["sink_us"] / 1e6
+    print(f"sink: host sent {args.count} in {host_secs:.3f} s, target counted {report['sink_pkts']}, "
+          f"lost {report['sink_lost']}, reordered {report['sink_reordered']}")
+    if secs:
+        print(f"downstream throughput: {report['sink_bytes'] * 8 / secs / 1e6:.2f} Mbit/s, "
+              f"{report['sink_pkts'] / secs:.0f} datagrams/s")
+
+
+def run_cmd(sock, args):
+    """Command round trip: HCI_Read_BD_ADDR until its Command Complete."""
+    cmd = struct.pack("<BHB", H4_COMMAND, OP_READ_BD_ADDR, 0)
+    rtts = []
+    lost = 0
+    start = now_us()
+
+    for seq in range(args.count):
+        pace(start, seq, args.interval_us)
+        t = now_us()
+        sock.send(cmd)
+        deadline = time.monotonic() + args.timeout
+        while True:
+            sock.settimeout(max(0.001, deadline - time.monotonic()))
+            try:
+                data = sock.recv(2048)
+            except socket.timeout:
+                lost += 1
+                break
+            if len(data) >= 6 and data[0] == H4_EVENT and data[1] == EVT_CMD_COMPLETE and \
+                    struct.unpack_from("<H", data, 4)[0] == OP_READ_BD_ADDR:
+                rtts.append(now_us() - t)
+                break
+
+    print(f"cmd: {args.count} sent, {len(rtts)} completed, {lost} timed out")
+    print_distribution("command round trip", rtts)
+
+
+def run_acl(sock, args):
+    """ACL round trip, needs a controller that loops ACL data back."""
+    size = max(args.size, 8)
+    pad = bytes(size - 8)
+    sent = {}
+    rtts = []
+    start = now_us()
+
+    sock.setblocking(False)
+    for seq in range(args.count):
+        pace(start, seq, args.interval_us)
+        t = now_us()
+        sent[seq] = t
+        sock.send(struct.pack("<BHHII", H4_ACL, ACL_HANDLE | 0x2000, size, seq, t & 0xffffffff) + pad)
+        rtts += drain_acl(sock, sent)
+
+    deadline = time.monotonic() + args.timeout
+    while sent and time.monotonic() < deadline:
+        time.sleep(0.001)
+        rtts += drain_acl(sock, sent)
+    secs = (now_us() - start) / 1e6
+
+    print(f"acl: {args.count} sent, {len(rtts)} looped back, {len(sent)} lost, {size} bytes payload")
+    print(f"throughput: {len(rtts) * size * 8 / secs / 1e6:.2f} Mbit/s each way")
+    print_distribution("acl round trip", rtts)
+
+
+def drain_acl(sock, sent):
+    rtts = []
+    while True:
+        try:
+            data = sock.recv(2048)
+        except BlockingIOError:
+            return rtts
+        if len(data) < 9 or data[0] != H4_ACL:
+            continue
+        t = sent.pop(struct.unpack_from("<I", data, 5)[0], None)
+        if t is not None:
+            rtts.append(now_us() - t)
+
+
+def bucket_percentile(buckets, count, p):
+    """Upper bound in us of the log2 bucket holding the p-th percentile."""
+    target = p / 100.0 * count
+    seen = 0
+    for i, n in enumerate(buckets):
+        seen += n
+        if n and seen >= target:
+            return 1 << (i + 1)
+    return 1 << LAT_BUCKETS
+
+
+def run_lat(sock, args):
+    """Print the target's per stage latency histograms, see hci_lat.h."""
+    sock.settimeout(args.timeout)
+    print(f"{'stage':<10} {'type':<4} {'count':>8} {'mean':>7} " +
+          " ".join(f"{'p' + format(p, 'g'):>7}" for p in PERCENTILES) + f" {'max':>7}  (us, percentiles <=)")
+    for stage, stage_name in enumerate(LAT_STAGES):
+        for h4_type, type_name in H4_TYPES.items():
+            sock.send(bytes([PKT_CTRL, CTRL_LAT_GET, stage, h4_type]))
+            try:
+                data = sock.recv(2048)
+            except socket.timeout:
+                raise RuntimeError("no latency answer, is HCI_IP_LATENCY enabled?")
+            if len(data) < 20 + 4 * LAT_BUCKETS or data[0] != PKT_CTRL or data[1] != CTRL_LAT_RSP:
+                raise RuntimeError("unexpected latency answer")
+            count, max_us, sum_us = struct.unpack_from("<IIQ", data, 4)
+            if not count:
+                continue
+            buckets = struct.unpack_from(f"<{LAT_BUCKETS}I", data, 20)
+            parts = " ".join(f"{min(bucket_percentile(buckets, count, p), max_us):>7}" for p in PERCENTILES)
+            print(f"{stage_name:<10} {type_name:<4} {count:>8} {sum_us // count:>7} {parts} {max_us:>7}")
+
+
+def run_lat_reset(sock, args):
+    sock.send(bytes([PKT_CTRL, CTRL_LAT_RESET]))
+    print("latency histograms cleared")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="HCI-IP link benchmark")
+    parser.add_argument("target", help="target IP address")
+    parser.add_argument("mode", choices=("echo", "stream", "sink", "cmd", "acl", "lat", "lat-reset"))
+    parser.add_argument("--port", type=int, default=3333)
+    parser.add_argument("--count", type=int, default=1000)
+    parser.add_argument("--size", type=int, default=64, help="datagram size in bytes")
+    parser.add_argument("--interval-us", type=int, default=1000, help="0 sends as fast as possible")
+    parser.add_argument("--timeout", type=float, default=1.0, help="seconds to wait for stragglers")
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.connect((args.target, args.port))
+
+    try:
+        modes = {"echo": run_echo, "stream": run_stream, "sink": run_sink, "cmd": run_cmd, "acl": run_acl,
+                 "lat": run_lat, "lat-reset": run_lat_reset}
+        modes[args.mode](sock, args)
+    except RuntimeError as e:
+        print(f"error: {e}", file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,262 @@
+/* HCI-IP H4 parser tests
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "unity.h"
+#include "hci_proto.h"
+#include "hci_h4.h"
+
+#define BENCH_ROUNDS        200000
+
+static uint8_t s_buf[2 * HCI_IP_MAX_PKT_SIZE];
+
+/*
+ * @brief: Build an H4 packet with a valid header into s_buf
+ * return: total length
+ */
+static uint16_t make_pkt(uint8_t type, uint16_t payload_len)
+{
+    memset(s_buf, 0xa5, sizeof(s_buf));
+    s_buf[0] = type;
+    switch (type)
+    {
+      case H4_TYPE_COMMAND:
+        s_buf[1] = 0x03;                    // HCI_Reset, OGF 0x03
+        s_buf[2] = 0x0c;
+        s_buf[3] = payload_len;
+        return 1 + 3 + payload_len;
+      case H4_TYPE_ACL:
+      case H4_TYPE_ISO:
+        s_buf[1] = 0x01;                    // handle 1, flags 0
+        s_buf[2] = 0x00;
+        s_buf[3] = payload_len & 0xff;
+        s_buf[4] = payload_len >> 8;
+        return 1 + 4 + payload_len;
+      case H4_TYPE_SCO:
+        s_buf[1] = 0x01;
+        s_buf[2] = 0x00;
+        s_buf[3] = payload_len;
+        return 1 + 3 + payload_len;
+      case H4_TYPE_EVENT:
+        s_buf[1] = 0x0e;                    // Command Complete
+        s_buf[2] = payload_len;
+        return 1 + 2 + payload_len;
+      default:
+        return 0;
+    }
+}
+
+static void check_ok(uint8_t type, uint8_t hdr_len, uint16_t payload_len)
+{
+    hci_h4_pkt_t pkt;
+    uint16_t len = make_pkt(type, payload_len);
+
+    TEST_ASSERT_EQUAL(HCI_H4_OK, hci_h4_parse(s_buf, len, &pkt));
+    TEST_ASSERT_EQUAL_UINT8(type, pkt.type);
+    TEST_ASSERT_EQUAL_UINT8(hdr_len, pkt.hdr_len);
+    TEST_ASSERT_EQUAL_UINT16(payload_len, pkt.payload_len);
+    TEST_ASSERT_EQUAL_UINT16(len, pkt.total_len);
+    // zero copy: both pointers are into the caller's buffer
+    TEST_ASSERT_EQUAL_PTR(&s_buf[1], pkt.hdr);
+    TEST_ASSERT_EQUAL_PTR(&s_buf[1 + hdr_len], pkt.payload);
+    TEST_ASSERT_EQUAL(HCI_H4_OK, hci_h4_validate(HCI_H4_DIR_H2C, s_buf, len, &pkt));
+}
+
+TEST_CASE("every H4 type parses with empty and maximum payload", "[h4]")
+{
+    check_ok(H4_TYPE_COMMAND, 3, 0);
+    check_ok(H4_TYPE_COMMAND, 3, HCI_IP_MAX_CMD_PARAM_LEN);
+    check_ok(H4_TYPE_ACL, 4, 0);
+    check_ok(H4_TYPE_ACL, 4, HCI_IP_MAX_ACL_DATA_LEN);
+    check_ok(H4_TYPE_SCO, 3, 0);
+    check_ok(H4_TYPE_SCO, 3, HCI_IP_MAX_SCO_DATA_LEN);
+    check_ok(H4_TYPE_EVENT, 2, 0);
+    check_ok(H4_TYPE_EVENT, 2, HCI_IP_MAX_EVT_PARAM_LEN);
+    check_ok(H4_TYPE_ISO, 4, 0);
+    check_ok(H4_TYPE_ISO, 4, HCI_IP_MAX_ACL_DATA_LEN);
+}
+
+TEST_CASE("unknown type bytes are rejected", "[h4]")
+{
+    static const uint8_t types[] = { 0x00, 0x06, 0x0a, 0x0b, 0x0c, 0xff };
+    hci_h4_pkt_t pkt;
+
+    for (size_t i = 0; i < sizeof(types); i++) {
+        memset(s_buf, 0, 8);
+        s_buf[0] = types[i];
+        TEST_ASSERT_EQUAL(HCI_H4_BAD_TYPE, hci_h4_parse(s_buf, 8, &pkt));
+        TEST_ASSERT_EQUAL(HCI_H4_BAD_TYPE, hci_h4_validate(HCI_H4_DIR_C2H, s_buf, 8, &pkt));
+    }
+}
+
+TEST_CASE("truncated headers need more data in a stream and are truncated in a datagram", "[h4]")
+{
+    static const struct { uint8_t type; uint8_t hdr_len; } types[] = {
+        { H4_TYPE_COMMAND, 3 }, { H4_TYPE_ACL, 4 }, { H4_TYPE_SCO, 3 }, { H4_TYPE_EVENT, 2 }, { H4_TYPE_ISO, 4 },
+    };
+    hci_h4_pkt_t pkt;
+
+    TEST_ASSERT_EQUAL(HCI_H4_NEED_MORE, hci_h4_parse(s_buf, 0, &pkt));
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        make_pkt(types[i].type, 0);
+        // every length short of the full header, type byte included
+        for (size_t len = 1; len < 1u + types[i].hdr_len; len++) {
+            TEST_ASSERT_EQUAL(HCI_H4_NEED_MORE, hci_h4_parse(s_buf, len, &pkt));
+            TEST_ASSERT_EQUAL(HCI_H4_TRUNCATED, hci_h4_validate(HCI_H4_DIR_H2C, s_buf, len, &pkt));
+        }
+    }
+}
+
+TEST_CASE("payload shorter or longer than the header announces", "[h4]")
+{
+    hci_h4_pkt_t pkt;
+    uint16_t len = make_pkt(H4_TYPE_ACL, 27);
+
+    TEST_ASSERT_EQUAL(HCI_H4_NEED_MORE, hci_h4_parse(s_buf, len - 1, &pkt));
+    TEST_ASSERT_EQUAL(HCI_H4_TRUNCATED, hci_h4_validate(HCI_H4_DIR_H2C, s_buf, len - 1, &pkt));
+    TEST_ASSERT_EQUAL(HCI_H4_TRAILING, hci_h4_validate(HCI_H4_DIR_H2C, s_buf, len + 1, &pkt));
+
+    // a stream parse stops at the end of the first packet
+    TEST_ASSERT_EQUAL(HCI_H4_OK, hci_h4_parse(s_buf, len + 1, &pkt));
+    TEST_ASSERT_EQUAL_UINT16(len, pkt.total_len);
+
+    len = make_pkt(H4_TYPE_EVENT, 4);
+    TEST_ASSERT_EQUAL(HCI_H4_TRUNCATED, hci_h4_validate(HCI_H4_DIR_C2H, s_buf, len - 4, &pkt));
+    TEST_ASSERT_EQUAL(HCI_H4_TRAILING, hci_h4_validate(HCI_H4_DIR_C2H, s_buf, len + 3, &pkt));
+}
+
+TEST_CASE("ACL and ISO longer than the controller maximum are rejected", "[h4]")
+{
+    hci_h4_pkt_t pkt;
+    uint16_t len = make_pkt(H4_TYPE_ACL, HCI_IP_MAX_ACL_DATA_LEN + 1);
+
+    // rejected from the header alone, the payload does not have to be there
+    TEST_ASSERT_EQUAL(HCI_H4_TOO_LONG, hci_h4_parse(s_buf, 5, &pkt));
+    TEST_ASSERT_EQUAL(HCI_H4_TOO_LONG, hci_h4_validate(HCI_H4_DIR_H2C, s_buf, len, &pkt));
+
+    make_pkt(H4_TYPE_ACL, 0xffff);
+    TEST_ASSERT_EQUAL(HCI_H4_TOO_LONG, hci_h4_parse(s_buf, 5, &pkt));
+
+    len = make_pkt(H4_TYPE_ISO, HCI_IP_MAX_ACL_DATA_LEN + 1);
+    TEST_ASSERT_EQUAL(HCI_H4_TOO_LONG, hci_h4_validate(HCI_H4_DIR_C2H, s_buf, len, &pkt));
+}
+
+TEST_CASE("ISO length ignores the two RFU bits", "[h4]")
+{
+    hci_h4_pkt_t pkt;
+    uint16_t len = make_pkt(H4_TYPE_ISO, 100);
+
+    // ISO_Data_Load_Length is 14 bits, the top two bits of the field are RFU
+    s_buf[4] |= 0xc0;
+    TEST_ASSERT_EQUAL(HCI_H4_OK, hci_h4_validate(HCI_H4_DIR_C2H, s_buf, len, &pkt));
+    TEST_ASSERT_EQUAL_UINT16(100, pkt.payload_len);
+
+    // the same bits are part of the length for ACL
+    len = make_pkt(H4_TYPE_ACL, 100);
+    s_buf[4] |= 0xc0;
+    TEST_ASSERT_EQUAL(HCI_H4_TOO_LONG, hci_h4_validate(HCI_H4_DIR_C2H, s_buf, len, &pkt));
+
+    // the connection handle and flags do not change the length
+    len = make_pkt(H4_TYPE_ISO, 100);
+    s_buf[1] = 0xff;
+    s_buf[2] = 0xff;
+    TEST_ASSERT_EQUAL(HCI_H4_OK, hci_h4_validate(HCI_H4_DIR_C2H, s_buf, len, &pkt));
+    TEST_ASSERT_EQUAL_UINT16(100, pkt.payload_len);
+}
+
+TEST_CASE("back to back packets are split from a stream", "[h4]")
+{
+    uint8_t stream[64];
+    size_t fill = 0;
+    hci_h4_pkt_t pkt;
+
+    uint16_t len = make_pkt(H4_TYPE_COMMAND, 2);
+    memcpy(&stream[fill], s_buf, len);
+    fill += len;
+    len = make_pkt(H4_TYPE_ACL, 9);
+    memcpy(&stream[fill], s_buf, len);
+    fill += len;
+    len = make_pkt(H4_TYPE_EVENT, 5);
+    memcpy(&stream[fill], s_buf, len);
+    fill += len;
+
+    static const uint8_t expect[] = { H4_TYPE_COMMAND, H4_TYPE_ACL, H4_TYPE_EVENT };
+    size_t pos = 0;
+    for (size_t i = 0; i < sizeof(expect); i++) {
+        TEST_ASSERT_EQUAL(HCI_H4_OK, hci_h4_parse(&stream[pos], fill - pos, &pkt));
+        TEST_ASSERT_EQUAL_UINT8(expect[i], pkt.type);
+        pos += pkt.total_len;
+    }
+    TEST_ASSERT_EQUAL(fill, pos);
+}
+
+TEST_CASE("results are counted per direction", "[h4]")
+{
+    hci_h4_stats_t h2c_before, c2h_before, h2c, c2h;
+    hci_h4_pkt_t pkt;
+
+    hci_h4_get_stats(HCI_H4_DIR_H2C, &h2c_before);
+    hci_h4_get_stats(HCI_H4_DIR_C2H, &c2h_before);
+
+    uint16_t len = make_pkt(H4_TYPE_ACL, 10);
+    hci_h4_validate(HCI_H4_DIR_H2C, s_buf, len, &pkt);
+    hci_h4_validate(HCI_H4_DIR_H2C, s_buf, len - 1, &pkt);
+    hci_h4_validate(HCI_H4_DIR_H2C, s_buf, len + 1, &pkt);
+    len = make_pkt(H4_TYPE_ACL, HCI_IP_MAX_ACL_DATA_LEN + 1);
+    hci_h4_validate(HCI_H4_DIR_C2H, s_buf, len, &pkt);
+    s_buf[0] = 0x07;
+    hci_h4_validate(HCI_H4_DIR_C2H, s_buf, len, &pkt);
+
+    hci_h4_get_stats(HCI_H4_DIR_H2C, &h2c);
+    hci_h4_get_stats(HCI_H4_DIR_C2H, &c2h);
+    TEST_ASSERT_EQUAL_UINT32(1, h2c.ok[H4_TYPE_ACL] - h2c_before.ok[H4_TYPE_ACL]);
+    TEST_ASSERT_EQUAL_UINT32(1, h2c.truncated - h2c_before.truncated);
+    TEST_ASSERT_EQUAL_UINT32(1, h2c.trailing - h2c_before.trailing);
+    TEST_ASSERT_EQUAL_UINT32(0, h2c.too_long - h2c_before.too_long);
+    TEST_ASSERT_EQUAL_UINT32(1, c2h.too_long - c2h_before.too_long);
+    TEST_ASSERT_EQUAL_UINT32(1, c2h.bad_type - c2h_before.bad_type);
+    TEST_ASSERT_EQUAL_UINT32(0, c2h.ok[H4_TYPE_ACL] - c2h_before.ok[H4_TYPE_ACL]);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void bench(const char *name, uint8_t type, uint16_t payload_len)
+{
+    hci_h4_pkt_t pkt;
+    uint16_t len = make_pkt(type, payload_len);
+    uint32_t ok = 0;
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < BENCH_ROUNDS; i++)
+        ok += hci_h4_validate(HCI_H4_DIR_C2H, s_buf, len, &pkt) == HCI_H4_OK;
+    uint64_t ns = now_ns() - start;
+
+    TEST_ASSERT_EQUAL_UINT32(BENCH_ROUNDS, ok);
+    printf("%-24s %4u bytes: %6.1f ns per packet\n", name, len, (double)ns / BENCH_ROUNDS);
+}
+
+TEST_CASE("validate micro-benchmark", "[h4][bench]")
+{
+    bench("HCI_Reset", H4_TYPE_COMMAND, 0);
+    bench("Command Complete", H4_TYPE_EVENT, 4);
+    bench("LE Advertising Report", H4_TYPE_EVENT, 43);
+    bench("ACL, full size", H4_TYPE_ACL, HCI_IP_MAX_ACL_DATA_LEN);
+    bench("ISO", H4_TYPE_ISO, 120);
+}
+
+void app_main(void)
+{
+    unity_run_all_tests();
+}
@@ -0,0 +1,164 @@
+/* HCI-IP upstream order tests
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+#include "unity.h"
+// the scheduler is static, it is driven here without the upstream task
+#include "hci_uplink.c"
+
+#define MAX_PKTS            16
+
+static uint8_t s_order[MAX_PKTS];
+static int s_sent;
+
+/* bundling and the other negotiated features stay off */
+uint32_t hci_ctrl_features(void)
+{
+    return 0;
+}
+
+static void reset_rings(void)
+{
+    hci_ring_init(&s_rings[HCI_UPLINK_PRIO_CMD], s_ring_cmd, sizeof(s_ring_cmd));
+    hci_ring_init(&s_rings[HCI_UPLINK_PRIO_SCO], s_ring_sco, sizeof(s_ring_sco));
+    hci_ring_init(&s_rings[HCI_UPLINK_PRIO_EVT], s_ring_evt, sizeof(s_ring_evt));
+    hci_ring_init(&s_rings[HCI_UPLINK_PRIO_ACL], s_ring_acl, sizeof(s_ring_acl));
+    atomic_store(&s_lifecycle_put, 0);
+    s_lifecycle_taken = 0;
+    s_barrier_valid = false;
+    s_sent = 0;
+}
+
+/*
+ * @brief: Queue one packet, its last byte is a tag to follow it upstream
+ */
+static void put_acl(uint8_t tag)
+{
+    const uint8_t pkt[] = { H4_TYPE_ACL, 0x01, 0x00, 0x01, 0x00, tag };
+    TEST_ASSERT_EQUAL(0, hci_uplink_put(pkt, sizeof(pkt), 0));
+}
+
+static void put_evt(uint8_t code, uint8_t tag)
+{
+    const uint8_t pkt[] = { H4_TYPE_EVENT, code, 0x01, tag };
+    TEST_ASSERT_EQUAL(0, hci_uplink_put(pkt, sizeof(pkt), 0));
+}
+
+static void put_le_evt(uint8_t subevt, uint8_t tag)
+{
+    const uint8_t pkt[] = { H4_TYPE_EVENT, EVT_LE_META, 0x02, subevt, tag };
+    TEST_ASSERT_EQUAL(0, hci_uplink_put(pkt, sizeof(pkt), 0));
+}
+
+/*
+ * @brief: Empty the rings the way the upstream task does, without bundling
+ */
+static void drain(void)
+{
+    int prio;
+
+    while ((prio = next_class()) >= 0) {
+        uint16_t len;
+        uint8_t *data = take_record(prio, &len);
+        TEST_ASSERT_LESS_THAN(MAX_PKTS, s_sent);
+        s_order[s_sent++] = data[len - 1];
+        release(prio, data);
+    }
+}
+
+TEST_CASE("lifecycle events are classed with ACL data", "[uplink]")
+{
+    const uint8_t conn[] = { H4_TYPE_EVENT, EVT_CONN_CMPL, 0x01, 0x00 };
+    const uint8_t disconn[] = { H4_TYPE_EVENT, EVT_DISCONN_CMPL, 0x01, 0x00 };
+    const uint8_t enc[] = { H4_TYPE_EVENT, EVT_ENC_CHANGE, 0x01, 0x00 };
+    const uint8_t enc_v2[] = { H4_TYPE_EVENT, EVT_ENC_CHANGE_V2, 0x01, 0x00 };
+    const uint8_t le_conn[] = { H4_TYPE_EVENT, EVT_LE_META, 0x01, SUBEVT_LE_CONN_CMPL };
+    const uint8_t le_enh[] = { H4_TYPE_EVENT, EVT_LE_META, 0x01, SUBEVT_LE_ENH_CONN_CMPL };
+    const uint8_t le_enh_v2[] = { H4_TYPE_EVENT, EVT_LE_META, 0x01, SUBEVT_LE_ENH_CONN_CMPL_V2 };
+    const uint8_t le_adv[] = { H4_TYPE_EVENT, EVT_LE_META, 0x01, 0x02 };
+    const uint8_t status[] = { H4_TYPE_EVENT, EVT_CMD_STATUS, 0x01, 0x00 };
+
+    TEST_ASSERT_EQUAL(HCI_UPLINK_PRIO_ACL, classify(conn, sizeof(conn)));
+    TEST_ASSERT_EQUAL(HCI_UPLINK_PRIO_ACL, classify(disconn, sizeof(disconn)));
+    TEST_ASSERT_EQUAL(HCI_UPLINK_PRIO_ACL, classify(enc, sizeof(enc)));
+    TEST_ASSERT_EQUAL(HCI_UPLINK_PRIO_ACL, classify(enc_v2, sizeof(enc_v2)));
+    TEST_ASSERT_EQUAL(HCI_UPLINK_PRIO_ACL, classify(le_conn, sizeof(le_conn)));
+    TEST_ASSERT_EQUAL(HCI_UPLINK_PRIO_ACL, classify(le_enh, sizeof(le_enh)));
+    TEST_ASSERT_EQUAL(HCI_UPLINK_PRIO_ACL, classify(le_enh_v2, sizeof(le_enh_v2)));
+    TEST_ASSERT_EQUAL(HCI_UPLINK_PRIO_EVT, classify(le_adv, sizeof(le_adv)));
+    TEST_ASSERT_EQUAL(HCI_UPLINK_PRIO_CMD, classify(status, sizeof(status)));
+}
+
+TEST_CASE("classes keep strict priority without lifecycle events", "[uplink]")
+{
+    static const uint8_t expected[] = { 3, 2, 1 };
+
+    reset_rings();
+    put_acl(1);
+    put_le_evt(0x02, 2);
+    put_evt(EVT_CMD_COMPLETE, 3);
+    drain();
+    TEST_ASSERT_EQUAL(sizeof(expected), s_sent);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, s_order, sizeof(expected));
+}
+
+TEST_CASE("nothing newer overtakes a pending Disconnection Complete", "[uplink]")
+{
+    // the old link's data and teardown, then a new connection on the same
+    // handle with a Command Status and a Data Length Change behind it
+    static const uint8_t expected[] = { 1, 2, 3, 4, 5, 6 };
+
+    reset_rings();
+    put_acl(1);
+    put_acl(2);
+    put_evt(EVT_DISCONN_CMPL, 3);
+    put_le_evt(SUBEVT_LE_ENH_CONN_CMPL, 4);
+    put_evt(EVT_CMD_STATUS, 5);
+    put_le_evt(0x07, 6);
+    drain();
+    TEST_ASSERT_EQUAL(sizeof(expected), s_sent);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, s_order, sizeof(expected));
+}
+
+TEST_CASE("older packets still overtake a lifecycle event", "[uplink]")
+{
+    // Command Complete 2 predates the disconnection and keeps its priority,
+    // Command Complete 5 waits for it, ACL data 4 stays behind it
+    static const uint8_t expected[] = { 2, 1, 3, 5, 4 };
+
+    reset_rings();
+    put_acl(1);
+    put_evt(EVT_CMD_COMPLETE, 2);
+    put_evt(EVT_DISCONN_CMPL, 3);
+    put_acl(4);
+    put_evt(EVT_CMD_COMPLETE, 5);
+    drain();
+    TEST_ASSERT_EQUAL(sizeof(expected), s_sent);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, s_order, sizeof(expected));
+}
+
+TEST_CASE("ACL data follows the Connection Complete of its link", "[uplink]")
+{
+    // the advertising report queued before the link goes first, the one
+    // after it still has priority over the data, but not over the link
+    static const uint8_t expected[] = { 1, 2, 4, 3 };
+
+    reset_rings();
+    put_le_evt(0x02, 1);
+    put_le_evt(SUBEVT_LE_CONN_CMPL, 2);
+    put_acl(3);
+    put_le_evt(0x02, 4);
+    drain();
+    TEST_ASSERT_EQUAL(sizeof(expected), s_sent);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, s_order, sizeof(expected));
+}
+
+void app_main(void)
+{
+    unity_run_all_tests();
+}
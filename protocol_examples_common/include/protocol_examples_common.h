@@ -136,6 +136,24 @@ esp_err_t example_configure_stdin_stdout(void);
  */
 esp_netif_t *get_example_netif_from_desc(const char *desc);
 
+#if CONFIG_EXAMPLE_CONNECT_WIFI
+/**
+ * @brief Handler for an extra token typed after the password
+ */
+typedef esp_err_t (*example_provision_extra_cb_t)(const char *token);
+
+/**
+ * @brief Accept one more token on the console provisioning line
+ *
+ * The line becomes "ssid password [token]". The handler is called with the
+ * token, when present, before the restart. Call before example_connect().
+ *
+ * @param cb handler, NULL to drop the token again
+ * @param help description of the token shown in the prompt
+ */
+void example_set_provision_extra(example_provision_extra_cb_t cb, const char *help);
+#endif
+
 #if CONFIG_EXAMPLE_PROVIDE_WIFI_CONSOLE_CMD
 /**
  * @brief Register wifi connect commands
@@ -17,6 +17,8 @@
 #include "example_common_private.h"
 #include "esp_wifi.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
 #include "rom/uart.h"
 
 #if CONFIG_EXAMPLE_CONNECT_WIFI
@@ -31,6 +33,110 @@ static SemaphoreHandle_t s_semph_get_ip6_addrs = NULL;
 static int s_retry_num = 0;
 static bool stop_wifi_retry = false;
 
+#if CONFIG_EXAMPLE_WIFI_FAST_RECONNECT
+#define FAST_AP_NAMESPACE   "wifi_fast"
+#define FAST_AP_KEY         "ap"
+
+/* the last AP that gave us an IP, kept in NVS across reboots */
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t bssid[6];
+    uint8_t channel;
+} fast_ap_t;
+
+static fast_ap_t s_fast_ap;
+static bool s_fast_ap_valid = false;
+static bool s_fast_ap_directed = false;   // wifi config currently pinned to s_fast_ap
+static int64_t s_disconnect_us = 0;
+
+static void fast_ap_load(void)
+{
+    nvs_handle_t nvs;
+    size_t len = sizeof(s_fast_ap);
+
+    if (nvs_open(FAST_AP_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK)
+        return;
+    s_fast_ap_valid = nvs_get_blob(nvs, FAST_AP_KEY, &s_fast_ap, &len) == ESP_OK && len == sizeof(s_fast_ap);
+    nvs_close(nvs);
+}
+
+/*
+ * @brief: Remember the AP we are associated with, flash is only written when it changed
+ */
+static void fast_ap_store(void)
+{
+    wifi_ap_record_t ap;
+    fast_ap_t cur = { 0 };
+    nvs_handle_t nvs;
+
+    if (esp_wifi_sta_get_ap_info(&ap) != ESP_OK)
+        return;
+    memcpy(cur.ssid, ap.ssid, sizeof(cur.ssid));
+    memcpy(cur.bssid, ap.bssid, sizeof(cur.bssid));
+    cur.channel = ap.primary;
+
+    if (s_fast_ap_valid && memcmp(&cur, &s_fast_ap, sizeof(cur)) == 0)
+        return;
+    s_fast_ap = cur;
+    s_fast_ap_valid = true;
+
+    if (nvs_open(FAST_AP_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK)
+        return;
+    if (nvs_set_blob(nvs, FAST_AP_KEY, &s_fast_ap, sizeof(s_fast_ap)) == ESP_OK)
+        nvs_commit(nvs);
+    nvs_close(nvs);
+    ESP_LOGI(TAG, "Cached AP " MACSTR " on channel %d", MAC2STR(s_fast_ap.bssid), s_fast_ap.channel);
+}
+
+/*
+ * @brief: Pin the station to the cached BSSID and channel, or go back to a full scan
+ * return: true if the config is pinned
+ */
+static bool fast_ap_apply(wifi_config_t *cfg, bool directed)
+{
+    directed = directed && s_fast_ap_valid &&
+               strncmp((const char *)cfg->sta.ssid, (const char *)s_fast_ap.ssid, sizeof(s_fast_ap.ssid)) == 0;
+
+    if (directed) {
+        cfg->sta.bssid_set = true;
+        memcpy(cfg->sta.bssid, s_fast_ap.bssid, sizeof(cfg->sta.bssid));
+        cfg->sta.channel = s_fast_ap.channel;
+        cfg->sta.scan_method = WIFI_FAST_SCAN;
+    } else {
+        cfg->sta.bssid_set = false;
+        cfg->sta.channel = 0;
+        cfg->sta.scan_method = EXAMPLE_WIFI_SCAN_METHOD;
+    }
+    return directed;
+}
+
+/*
+ * @brief: Switch the station between directed and full scan connects, called while disconnected
+ */
+static void fast_ap_reconfigure(bool directed)
+{
+    wifi_config_t cfg;
+
+    if (directed == s_fast_ap_directed || esp_wifi_get_config(WIFI_IF_STA, &cfg) != ESP_OK)
+        return;
+    s_fast_ap_directed = fast_ap_apply(&cfg, directed);
+    esp_wifi_set_config(WIFI_IF_STA, &cfg);
+    if (!s_fast_ap_directed)
+        ESP_LOGI(TAG, "Cached AP not reachable, falling back to a full scan");
+}
+#endif
+
+/* optional token after the password, see example_set_provision_extra() */
+#define PROVISION_EXTRA_MAX 64
+static example_provision_extra_cb_t s_provision_extra;
+static const char *s_provision_extra_help;
+
+void example_set_provision_extra(example_provision_extra_cb_t cb, const char *help)
+{
+  s_provision_extra = cb;
+  s_provision_extra_help = help;
+}
+
 /*
  * @brief: Get WiFi SSID and password input from serial console and store in NVS
  * params: provisin_now
@@ -63,7 +169,7 @@ esp_err_t do_console_provision(bool provision_now, bool provision_reset)
     return stat;
   }
 
-  char buf[sizeof(wifi_config.sta.ssid)+sizeof(wifi_config.sta.password)+2] = {0};
+  char buf[sizeof(wifi_config.sta.ssid)+sizeof(wifi_config.sta.password)+PROVISION_EXTRA_MAX+3] = {0};
 
   // test console not to lose initial chars
   // TODO fix bug with ESP_LOG preventing first input char to be received
@@ -85,7 +191,10 @@ esp_err_t do_console_provision(bool provision_now, bool provision_reset)
     }
   }
 
-  ESP_LOGI(TAG, "Please input ssid password:");
+  if (s_provision_extra)
+    ESP_LOGI(TAG, "Please input ssid password [%s]:", s_provision_extra_help);
+  else
+    ESP_LOGI(TAG, "Please input ssid password:");
   memset(buf, 0, sizeof(buf));
   fgets(buf, sizeof(buf), stdin);
   int len = strlen(buf);
@@ -121,6 +230,9 @@ esp_err_t do_console_provision(bool provision_now, bool provision_reset)
 
       ESP_LOGI(TAG, "WIFI SSID: %s", (char *) wifi_config.sta.ssid);
       ESP_LOGI(TAG, "WIFI Password: %s", (char *) wifi_config.sta.password);
+      temp = strtok_r(NULL, " ", &rest);
+      if (temp && s_provision_extra && s_provision_extra(temp) != ESP_OK)
+        ESP_LOGE(TAG, "Extra provisioning token not applied");
   } else {
       wifi_config.sta.threshold.authmode = WIFI_AUTH_OPEN;
   }
@@ -155,6 +267,12 @@ static void example_handler_on_wifi_disconnect(void *arg, esp_event_base_t event
     if (!stop_wifi_retry)
     {
         ESP_LOGI(TAG, "Wi-Fi disconnected, trying to reconnect...");
+#if CONFIG_EXAMPLE_WIFI_FAST_RECONNECT
+        if (s_retry_num == 1)
+            s_disconnect_us = esp_timer_get_time();
+        // a blip usually leaves the AP where it was, only rescan when it does not answer
+        fast_ap_reconfigure(s_retry_num <= CONFIG_EXAMPLE_WIFI_FAST_RECONNECT_TRIES);
+#endif
         esp_err_t err = esp_wifi_connect();
         if (err == ESP_ERR_WIFI_NOT_STARTED) {
             return;
@@ -182,6 +300,14 @@ static void example_handler_on_sta_got_ip(void *arg, esp_event_base_t event_base
         return;
     }
     ESP_LOGI(TAG, "Got IPv4 event: Interface \"%s\" address: " IPSTR, esp_netif_get_desc(event->esp_netif), IP2STR(&event->ip_info.ip));
+#if CONFIG_EXAMPLE_WIFI_FAST_RECONNECT
+    if (s_disconnect_us) {
+        ESP_LOGI(TAG, "Reconnected in %lld ms (%s)", (esp_timer_get_time() - s_disconnect_us) / 1000,
+                 s_fast_ap_directed ? "cached AP" : "full scan");
+        s_disconnect_us = 0;
+    }
+    fast_ap_store();
+#endif
     if (s_semph_get_ip_addrs) {
         xSemaphoreGive(s_semph_get_ip_addrs);
     } else {
@@ -378,6 +504,13 @@ esp_err_t example_wifi_connect(void)
 
     memset(wifi_config.sta.password, 0, sizeof(wifi_config.sta.password));
     strncpy((char*)wifi_config.sta.password, (const char *)wifi_c.sta.password, sizeof(wifi_config.sta.password));
+#endif
+#if CONFIG_EXAMPLE_WIFI_FAST_RECONNECT
+    // after a reboot, try the AP of the last session on its channel first
+    fast_ap_load();
+    s_fast_ap_directed = fast_ap_apply(&wifi_config, true);
+    if (s_fast_ap_directed)
+        ESP_LOGI(TAG, "Trying cached AP " MACSTR " on channel %d", MAC2STR(s_fast_ap.bssid), s_fast_ap.channel);
 #endif
     return example_wifi_sta_do_connect(wifi_config, true);
 }